@@ -57,12 +57,68 @@
 #define		PITCHREPEAT		10		// 10 e's will be played for pitch adjust
 #define     FARNSREPEAT     10      // 10 a's will be played for Farnsworth
 
+// Groups played by the trainer
+#define		TRAINLEN		5		// Characters in a group
+#define		TRAINCALL		0		// Callsigns
+#define		TRAINCODE		1		// Code groups of letters and digits
+#define		TRAINQSO		2		// Contest exchanges, a report and a zone
+#define		TRAINWORDS		3		// Common words from the dictionaries
+#define		TRAINQCODES		4		// Q-codes and abbreviations
+#define		TRAINPREFIX		5		// Callsign prefixes
+
+#ifdef TRAINSTATS
+// Callsign trainer statistics
+#define		TRAINCHARS		36		// Letters A-Z and digits 0-9
+#define		TRAINMISS		6		// Highest miss count of a character, weights it 7:1
+#define		TRAINLATUNIT	4		// Heartbeats per unit of the response times
+#define		TRAINUP			90		// Rolling accuracy in % above which the speed goes up
+#define		TRAINDOWN		65		// and below which it goes down
+#define		TRAINMID		80		// Rolling accuracy after a speed step
+#endif
+
+// Flags of the entries in the command table
+#define		CMDLOCK			0x01	// Refused while the configuration is locked
+#define		CMDTX			0x02	// Keys the transmitter (keyer enabled while running)
+#define		CMDMACRO		0x04	// Plays a message, no 'R' and a longer timeout afterwards
+
 // Some texts in Flash used by the application
 const char txok[] PROGMEM = "R";
 const char vers[] PROGMEM = "V0.87";
 const char prgx[] PROGMEM = "#";// # decodes to prosign SK with no intercharacter gap
 const char imok[] PROGMEM = "73";
 
+// Patterns of the trainer groups: 'a' a letter, 'n' a digit, 'x' either, others as they are
+const char trainpats[][TRAINLEN + 1] PROGMEM = {
+	"aanaa",	// TRAINCALL
+	"xxxxx",	// TRAINCODE
+	"5n9nn"		// TRAINQSO
+};
+
+#ifdef TRAINDICT
+
+//! A packed dictionary of the trainer, in the order of TRAINWORDS..TRAINPREFIX (see tools/mkdict.c)
+struct dictionary {
+	const byte *bits;		//!< The words in 5 bit symbols
+	const word *index;		//!< Bit position of every DICTSTEP-th word
+	byte count;				//!< Number of words
+};
+
+#include "dict.h"			// Generated from the word lists in dict/ by the Makefile
+
+#define		TRAINMAX		DICTMAXLEN	// Longest group or word
+#else
+#define		TRAINMAX		TRAINLEN
+#endif
+
+#ifdef TRAINSTATS
+static byte trainmiss[TRAINCHARS];	// Recent misses of each character, 0..TRAINMISS
+static byte trainlat[TRAINCHARS];	// Average response time of each character in TRAINLATUNIT beats
+static byte trainacc = TRAINMID;	// Rolling accuracy in percent
+static word traincalls;				// Callsigns played in this session
+static word trainchars;				// Characters scored in this session
+static byte trainwpm;				// Speed of the trainer, 0 until the first session ends
+#endif
+
 void pitch(void)
 /*! 
  @brief     Pitch change mode
@@ -100,12 +156,16 @@ void pitch(void)
 
 }
 
-void setfarns(void)
+void setting(byte mode)
 /*! 
- @brief     Farnsworth change mode
+ @brief     Farnsworth, weight and compensation change mode
+ 
+ This function implements the change mode of the Farnsworth pause, and with WEIGHTING of the
+ keying weight and compensation. DIT adds a pause, weight or compensation, DAH removes it.
+ Once the paddles have been left alone, the new weight or compensation is sent as a number,
+ as the sidetone of the test pattern is not weighted.
  
- This function implements farnsworth pause change mode. Farnsworth pauses can be added or removed
- with the paddle keys.
+ @param mode    FARNSWORTH, WEIGHT or COMPENSATION
  
  */
 {
@@ -125,132 +185,403 @@ void setfarns(void)
 
 		if (!(KEYINP & (1 << DITPIN))) // if DIT was keyed
 		{
-			yackspeed(DOWN, FARNSWORTH);		// increase interword spacing
+			yackspeed(DOWN, mode);		// increase interword spacing or weight
 			timer = 0;
 		}
 
 		else if (!(KEYINP & (1 << DAHPIN))) // if DAH was keyed
 		{
-			yackspeed(UP, FARNSWORTH);	// decrease interword spacing
+			yackspeed(UP, mode);	// decrease interword spacing or weight
 			timer = 0;
 		}
 
 	}
 
+#ifdef WEIGHTING
+	if (mode != FARNSWORTH)
+		yacknumber(yackweight(mode));
+#endif
+
 }
 
-word lfsr(byte n)
+#ifdef TRAINSTATS
+
+byte trainidx(char c)
 /*! 
- @brief     Simple random number generator
+ @brief     Index of a character in the trainer statistics
  
- The library function random number generator works fine but is 
- a nightmare in size as it utilizes various multiplications and
- divisions (+600 Byte). This routine implements a LFSR (linear
- feedback shift register) in the Galois method which is good enough 
- for this specific application.
+ @param c   A letter A-Z or a digit 0-9
+ @return    0..25 for the letters, 26..35 for the digits
+ */
+{
+
+	if (c >= 'A')
+		return c - 'A';
+
+	return c - '0' + 26;
+
+}
+
+#endif
+
+char idxchar(byte i)
+/*! 
+ @brief     Character of an index in the trainer statistics
  
- @param n    a number between 2 and 255
- @return     a random number between 0 and n-1
+ @param i   0..25 for the letters, 26..35 for the digits
+ @return    The letter A-Z or the digit 0-9
  */
 {
 
-	static word lfsr = 0xACE1;
-	byte random;
+	if (i < 26)
+		return i + 'A';
 
-	lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xB400u);
+	return i - 26 + '0';
+
+}
 
-	random = lfsr >> 8; // Byte = upper byte of word 
+char rndchar(byte first, byte n)
+/*! 
+ @brief     Picks a random character for a trainer group
+ 
+ With TRAINSTATS, every character has a weight of one more than its miss count, so the 
+ characters missed most recently come up more often until they are keyed correctly.
+ 
+ @param first   Index of the first character of the range, 0 for 'A', 26 for '0'
+ @param n       The number of characters in the range
+ @return        A character of the range
+ */
+{
+
+#ifdef TRAINSTATS
+
+	byte *miss = &trainmiss[first];
+	byte sum = 0;
+	byte r;
+	byte i;
 
-	while (random >= n)
-		random -= n; // Cheap modulo :-)
+	for (i = 0; i < n; i++)
+		sum += miss[i] + 1;
 
-	return random;
+	r = yackrandom(sum); // Draw one of the weighted slots
 
+	for (i = 0; r > miss[i]; i++)
+		r -= miss[i] + 1;
+
+	return idxchar(first + i);
+
+#else
+
+	return idxchar(first + yackrandom(n));
+
+#endif
+
+}
+
+#ifdef TRAINDICT
+
+byte dictsym(const byte *bits, word *pos)
+/*! 
+ @brief     Reads the next symbol of a packed dictionary
+ 
+ @param bits    The packed dictionary in flash
+ @param pos     Bit position of the symbol, advanced to the next one
+ @return        The symbol, 0..31
+ */
+{
+	word w;
+
+	w = pgm_read_byte(&bits[*pos / 8]) << 8;
+	w |= pgm_read_byte(&bits[*pos / 8 + 1]);
+	w >>= 11 - (*pos & 7);
+
+	*pos += 5;
+
+	return w & 0x1F;
+}
+
+byte dictword(byte d, char *buf)
+/*! 
+ @brief     Picks a random word of a dictionary
+ 
+ Decoding starts at the nearest index entry before the word, so at most DICTSTEP words
+ are unpacked.
+ 
+ @param d       The dictionary, 0 for the first one in dicts
+ @param buf     A buffer for DICTMAXLEN characters
+ @return        The length of the word
+ */
+{
+	const byte *bits = pgm_read_ptr(&dicts[d].bits);
+	const word *index = pgm_read_ptr(&dicts[d].index);
+	byte i = yackrandom(pgm_read_byte(&dicts[d].count));
+	word pos = pgm_read_word(&index[i / DICTSTEP]);
+	byte n;
+	byte s;
+
+	i %= DICTSTEP;
+
+	do { // Unpack the words up to the one drawn
+		n = 0;
+		while ((s = dictsym(bits, &pos))) {
+			if (s == DICTDIGIT)
+				buf[n++] = '0' + dictsym(bits, &pos);
+			else
+				buf[n++] = 'A' - 1 + s;
+		}
+	} while (i--);
+
+	return n;
 }
 
-void rndcall(char *call)
+#endif
+
+byte rndgroup(char *group, byte kind)
 /*! 
- @brief     Randomize a callsign
+ @brief     Makes up a group for the trainer
  
- This creates a random callsign with 2 letters + 1 digit + 2 letters
+ The group is generated in one pass over its pattern in trainpats, or drawn from
+ a dictionary.
  
- @param call a pointer to a buffer of sufficient size to store the callsign
+ @param group   A buffer for TRAINMAX characters
+ @param kind    TRAINCALL, TRAINCODE, TRAINQSO or, with TRAINDICT, a dictionary
+ @return        The number of characters in the group
  */
 {
 	byte i;
+	char c;
+
+#ifdef TRAINDICT
+	if (kind >= TRAINWORDS)
+		return dictword(kind - TRAINWORDS, group);
+#endif
+
+	for (i = 0; i < TRAINLEN; i++) {
+		c = pgm_read_byte(&trainpats[kind][i]);
+
+		if (c == 'a')
+			c = rndchar(0, 26);
+		else if (c == 'n')
+			c = rndchar(26, 10);
+		else if (c == 'x')
+			c = rndchar(0, 36);
+
+		group[i] = c;
+	}
 
-	// Generate a random callsign 2 Char, 1 Digit, 2 Char
+	return TRAINLEN;
+}
+
+#ifdef TRAINSTATS
+
+void trainscore(char want, char got, word ticks)
+/*! 
+ @brief     Records a character keyed in the callsign trainer
+ 
+ Updates the miss count and the response time of the character that was asked for and 
+ the rolling accuracy. A miss counts one up, a correct answer one down, so the weighting 
+ of rndchar fades once a character is mastered.
+ 
+ @param want    The character of the callsign
+ @param got     The character decoded from the paddles
+ @param ticks   Heartbeats from the end of the playback or the previous character
+ */
+{
+
+	byte *miss = &trainmiss[trainidx(want)];
+	byte *lat = &trainlat[trainidx(want)];
+	byte ok = (want == got);
+	word t = ticks / TRAINLATUNIT;
 
-	for (i = 0; i < 5; i++) {
-		if (i == 2)
-			call[i] = lfsr(10) + '0';
-		else
-			call[i] = lfsr(26) + 'A';
+	if (t > 255)
+		t = 255;
 
+	if (!*lat)
+		*lat = t; // First time, nothing to average yet
+	else
+		*lat += ((int16_t) t - *lat) / 4;
+
+	if (ok) {
+		if (*miss)
+			(*miss)--;
+	} else if (*miss < TRAINMISS)
+		(*miss)++;
+
+	trainacc += ((ok ? 100 : 0) - (int16_t) trainacc) / 8;
+
+	trainchars++;
+
+}
+
+void trainramp(void)
+/*! 
+ @brief     Adapts the training speed to the rolling accuracy
+ 
+ One WPM up above TRAINUP, one down below TRAINDOWN. The accuracy then starts over from
+ TRAINMID, so the next step needs a few more callsigns at the new speed. The speed is set
+ with yackwpmset, so it is not saved as the keyer speed (see cstrain).
+ */
+{
+
+	if (trainacc >= TRAINUP)
+		yackwpmset(yackwpm() + 1);
+	else if (trainacc < TRAINDOWN)
+		yackwpmset(yackwpm() - 1);
+	else
+		return;
+
+	trainacc = TRAINMID;
+
+}
+
+void trainstats(void)
+/*! 
+ @brief     Sends the statistics of the callsign trainer
+ 
+ Sends the number of groups played, the rolling accuracy in percent, the average 
+ response time per character in milliseconds and the character missed most often, if any.
+ */
+{
+
+	word sum = 0;
+	byte n = 0;
+	byte worst = 0;
+	byte i;
+
+	for (i = 0; i < TRAINCHARS; i++) {
+		if (trainlat[i]) {
+			sum += trainlat[i];
+			n++;
+		}
+		if (trainmiss[i] > trainmiss[worst])
+			worst = i;
 	}
+
+	yacknumber(traincalls);
+	yacknumber(trainacc);
+	yacknumber(yackdiv(sum, n) * (TRAINLATUNIT * YACKBEAT));
+
+	if (trainmiss[worst])
+		yackchar(idxchar(worst));
+
 }
 
-void cstrain(void)
+#endif
+
+void trainloop(byte kind)
 /*! 
  @brief     Callsign trainer mode
  
  This implements callsign training. The keyer plays a random callsign and the 
- user repeats it on the paddle. If a mistake happens, the error prosign is
- sounded, the callsign sent again and the user attempts one more time.
+ user repeats it on the paddle. Once all 5 characters have been keyed, 'R' is sounded
+ if they were all right. Otherwise the error prosign is sounded and the callsign sent 
+ again for another attempt. Code groups, contest exchanges and the words of the 
+ dictionaries are trained the same way.
+ 
+ With TRAINSTATS, every character keyed is scored, and the speed is adapted to the
+ rolling accuracy after each attempt.
+ 
+ @param kind    TRAINCALL, TRAINCODE, TRAINQSO or a dictionary
  */
 {
-	char call[5]; 	// A buffer to store the callsign
+	char call[TRAINMAX]; 	// A buffer to store the callsign
+	byte len;		// Characters in the callsign
 	char c;			// The character returned by IAMBIC keyer
 	byte i;			// Counter
 	byte n;			// Playback counter
+	byte errs;		// Wrong characters in this attempt
 	word timer;		// Timeout timer
+	word ticks;		// Response time of the current character
 
 	while (1)	// Endless loop will exit throught RETURN statement only
 
 	{
-		rndcall(call); // Make up a callsign
-
-		i = 0; // i counts the number of chracters correctly guessed
-
-		while (i < 5) {
-			if (!i) // If nothing guessed yet, play the callsign
-			{
-				yackdelay(2 * IWGLEN); // Give him some time to breathe b4 next callsign
-				for (n = 0; n < 5; n++) {
-					yackchar(call[n]);
-					yackfarns(); // Add potential farnsworth delays
-					if (yackctrlkey(TRUE))
-						return; // Abort if requested..
-				}
+		len = rndgroup(call, kind); // Make up a callsign
+
+		do {
+			yackdelay(2 * IWGLEN); // Give him some time to breathe b4 next callsign
+			for (n = 0; n < len; n++) {
+				yackchar(call[n]);
+				yackfarns(); // Add potential farnsworth delays
+				if (yackctrlkey(TRUE))
+					return; // Abort if requested..
 			}
 
-			timer = YACKSECS(TRAINTIMEOUT);
+			yackwait(); // Response times count from the end of the playback
+			if (yackctrlkey(TRUE))
+				return;
 
-			do {
+#ifdef TRAINSTATS
+			traincalls++;
+#endif
 
-				c = yackiambic(OFF); 	// Wait for a character
-				yackbeat();			// FSM heartbeat
-				timer--;			// Countdown
+			errs = 0;
 
-			} while ((!c) && timer && !(yackctrlkey(FALSE))); // Stop when character or timeout
+			for (i = 0; i < len; i++) {
+				timer = YACKSECS(TRAINTIMEOUT);
+				ticks = 0;
 
-			if (timer == 0 || yackctrlkey(TRUE))// If termination because of timeout
-				return;				// then return
+				do {
 
-			if (call[i] == c)		// Was it the right character?
-				i++;				// then increment counter
-			else {
-				yackerror();		// Send an error prosign
-				i = 0;				// And reset the counter
+					c = yackiambic(OFF); 	// Wait for a character
+					yackbeat();			// FSM heartbeat
+					timer--;			// Countdown
+					ticks++;
+
+				} while ((!c) && timer && !(yackctrlkey(FALSE))); // Stop when character or timeout
+
+				if (timer == 0 || yackctrlkey(TRUE))// If termination because of timeout
+					return;				// then return
+
+				if (call[i] != c)		// Was it the wrong character?
+					errs++;
+
+#ifdef TRAINSTATS
+				trainscore(call[i], c, ticks);
+#endif
 			}
 
-		}
+			if (errs)
+				yackerror();		// Send an error prosign
+
+#ifdef TRAINSTATS
+			trainramp();
+#endif
+
+		} while (errs); // Same callsign again until it is right
 
 		yackchar('R');
 
 	}
 }
 
+void cstrain(byte kind)
+/*! 
+ @brief     Runs the trainer at its own speed
+ 
+ With TRAINSTATS, the trainer ramps the speed while it runs. The keyer speed is held
+ aside with yackwpmhold, so that neither the ramp nor a speed change with the command 
+ key is saved as the keyer speed, and it is back when the trainer ends. The next session
+ starts at the speed this one ended.
+ 
+ @param kind    TRAINCALL, TRAINCODE, TRAINQSO or a dictionary
+ */
+{
+#ifdef TRAINSTATS
+	yackwpmhold(ON);
+
+	if (trainwpm)
+		yackwpmset(trainwpm);
+#endif
+
+	trainloop(kind);
+
+#ifdef TRAINSTATS
+	trainwpm = yackwpm();
+	yackwpmhold(OFF);
+#endif
+}
+
 void beacon(byte mode)
 /*! 
  @brief     Beacon mode
@@ -258,7 +589,8 @@ void beacon(byte mode)
  This routine can read a beacon transmission interval up to 
  9999 seconds and store it in EEPROM (RECORD mode)
  In PLAY mode, when called in the YACKBEAT loop, it plays back
- message 2 in the programmed interval
+ message 4 in the programmed interval. The interval is timed with the
+ seconds clock, which keeps running while the keyer is in standby.
  
  @param mode RECORD (read and store the beacon interval) or PLAY (beacon)
 
@@ -268,11 +600,14 @@ void beacon(byte mode)
 {
 
 	static word interval = 65000; // A dummy value that can not be reached
-	static word timer;
+	static word next; // Seconds clock at the next transmission
+	word timer;
 	char c;
 
-	if (interval == 65000)
+	if (interval == 65000) {
 		interval = yackuser(READ, 1, 0);
+		next = yacktime() + interval;
+	}
 
 	if (mode == RECORD) {
 		interval = 0; // Reset previous settings
@@ -293,43 +628,229 @@ void beacon(byte mode)
 
 		if (interval >= 0 && interval <= 9999) {
 			yackuser(WRITE, 1, interval); // Record interval
-			yacknumber(interval); // Playback number
+			yackdigits(interval, 1); // Playback number, cut with CUTNUMS
+			yackchar(' ');
+			yackwait();
 		} else {
 			yackerror();
 		}
 
+		next = yacktime() + interval;
+
 	}
 
 	if ((mode == PLAY) && interval) {
 
 #ifdef POWERSAVE
 
-		// If we execute this, the interval counter is positive which means we are waiting
-		// for a message playback. In this case we must not allow the CPU to enter sleep mode.
+		// If we execute this, we are waiting for a message playback. The CPU may go into
+		// standby, but must wake up in time for it.
 
-		yackpower(FALSE); // Inhibit sleep mode
+		yackalarm(next);
 
 #endif
 
-		if (timer)
-			timer--; // Countdown until a second has expired
-		else {
-			timer = YACKSECS(1); // Reset timer
+		if ((int16_t)(yacktime() - next) >= 0) // Interval expired?
+		{
+			yackmessage(PLAY, 4); // Play message 4
+			next = yacktime() + interval; // The next interval starts when it has been sent
+		}
+
+	}
 
-			if ((--interval) == 0) // Interval was > 0. Did decrement bring it to 0?
-					{
+}
 
-				interval = yackuser(READ, 1, 0); // Reset the interval timer
-				yackmessage(PLAY, 2); // And play message 2
+void cmdreset(byte n)
+/*! @brief Command R, resets all settings */
+{
+	yackreset();
+}
 
-			}
+void cmdsetting(byte n)
+/*! @brief Commands Z, 5 and 6, set the Farnsworth pause, the weight and the compensation */
+{
+	setting(n);
+}
 
-		}
+void cmdrecord(byte n)
+/*! @brief Commands 1 to 4, record message n */
+{
+	yackchar('0' + n);
+	yackmessage(RECORD, n);
+}
 
-	}
+void cmdplay(byte n)
+/*! @brief Commands E, I, T and M, play back message n */
+{
+	yackmessage(PLAY, n);
+}
 
+void cmdversion(byte n)
+/*! @brief Command V, sends the version */
+{
+	yackstring(vers);
 }
 
+void cmdpitch(byte n)
+/*! @brief Command P, sets the pitch */
+{
+	pitch();
+}
+
+void cmdtune(byte n)
+/*! @brief Command U, keys the transmitter for tuning */
+{
+	yacktune();
+}
+
+void cmdtrain(byte n)
+/*! @brief Commands C, J and O, trainer for callsigns, code groups and exchanges */
+{
+	cstrain(n);
+}
+
+char cmdchar(char prompt)
+/*! 
+ @brief     Reads the character that completes a command
+ 
+ Sends the prompt and waits up to DEFTIMEOUT seconds for a character to be keyed.
+ 
+ @param prompt  The command letter, sent as the prompt
+ @return        The character, or 0 after the timeout or a command key press
+ 
+ */
+{
+	word timer = YACKSECS(DEFTIMEOUT);
+	char c;
+
+	yackchar(prompt);
+
+	do {
+		c = yackiambic(OFF);
+		yackbeat();
+	} while (!c && --timer && !yackctrlkey(FALSE));
+
+	if (yackctrlkey(TRUE))
+		return 0;
+
+	return c;
+}
+
+#ifdef TRAINDICT
+void cmddict(byte n)
+/*! @brief Command Y, dictionary trainer for words (W), Q-codes (Q) or prefixes (P) */
+{
+	char c = cmdchar('Y'); // The letter of the dictionary
+
+	if (c == 'W')
+		cstrain(TRAINWORDS);
+	else if (c == 'Q')
+		cstrain(TRAINQCODES);
+	else if (c == 'P')
+		cstrain(TRAINPREFIX);
+	else if (c)
+		yackerror();
+}
+#endif
+
+#ifdef PROFILES
+void cmdprofile(byte n)
+/*! @brief Commands 7 and 8, recall (READ) or store (WRITE) the setting profile keyed as a digit */
+{
+	char c = cmdchar(n == READ ? '7' : '8');
+
+	if (c && !yackprofile(n, c - '0')) // Not a profile number, or nothing stored yet
+		yackerror();
+}
+#endif
+
+#ifdef TRAINSTATS
+void cmdgrade(byte n)
+/*! @brief Command G, sends the trainer statistics */
+{
+	trainstats();
+}
+#endif
+
+void cmdwpm(byte n)
+/*! @brief Command W, sends the speed */
+{
+	yacknumber(yackwpm());
+}
+
+#ifdef LATSTATS
+void cmdstats(byte n)
+/*! @brief Command Q, sends the latency statistics */
+{
+	yackstats();
+}
+#endif
+
+//! An entry of the command table
+struct command {
+	char letter;			//!< The command as keyed
+	byte flags;				//!< CMDLOCK, CMDTX, CMDMACRO
+	void (*handler)(byte);	//!< Executes the command
+	byte arg;				//!< Passed to the handler
+};
+
+//! Commands of command mode. The lockable configuration commands carry CMDLOCK.
+const struct command commands[] PROGMEM = {
+	{ 'R', CMDLOCK, cmdreset, 0 },					// Reset
+#ifndef FIXEDMODE
+	{ 'A', CMDLOCK, yackmode, IAMBICA },			// IAMBIC A
+	{ 'B', CMDLOCK, yackmode, IAMBICB },			// IAMBIC B
+	{ 'L', CMDLOCK, yackmode, ULTIMATIC },			// ULTIMATIC
+	{ 'D', CMDLOCK, yackmode, DAHPRIO },			// DAHPRIO
+#endif
+	{ 'X', CMDLOCK, yacktoggle, PDLSWAP },			// Paddle swapping
+	{ 'S', CMDLOCK, yacktoggle, SIDETONE },			// Sidetone toggle
+	{ 'K', CMDLOCK, yacktoggle, TXKEY },			// TX keying toggle
+	{ 'Z', CMDLOCK, cmdsetting, FARNSWORTH },		// Farnsworth pause
+	{ 'F', CMDLOCK, yacktoggle, TXINV },			// TX level inverter toggle
+#ifdef STRAIGHTKEY
+	{ 'H', CMDLOCK, yacktoggle, STRAIGHT },			// Straight key toggle
+#endif
+	{ '1', CMDLOCK, cmdrecord, 1 },					// Record Macro 1
+	{ '2', CMDLOCK, cmdrecord, 2 },					// Record Macro 2
+	{ '3', CMDLOCK, cmdrecord, 3 },					// Record Macro 3
+	{ '4', CMDLOCK, cmdrecord, 4 },					// Record Macro 4
+	{ 'N', CMDLOCK, beacon, RECORD },				// Automatic Beacon
+#ifdef WEIGHTING
+	{ '5', CMDLOCK, cmdsetting, WEIGHT },			// Keying weight
+	{ '6', CMDLOCK, cmdsetting, COMPENSATION },		// Keying compensation
+#endif
+#ifdef PROFILES
+	{ '7', CMDLOCK, cmdprofile, READ },				// Recall setting profile
+	{ '8', CMDLOCK, cmdprofile, WRITE },			// Store setting profile
+#endif
+	{ '9', CMDLOCK, yackoption, CUTNUMS },			// Cut numbers toggle
+
+	{ 'V', 0, cmdversion, 0 },						// Version
+	{ 'P', 0, cmdpitch, 0 },						// Pitch
+	{ 'U', CMDTX, cmdtune, 0 },						// Tune
+	{ 'C', 0, cmdtrain, TRAINCALL },				// Callsign training
+	{ 'J', 0, cmdtrain, TRAINCODE },				// Code group training
+	{ 'O', 0, cmdtrain, TRAINQSO },					// Contest exchange training
+#ifdef TRAINDICT
+	{ 'Y', 0, cmddict, 0 },							// Dictionary training
+#endif
+#ifdef TRAINSTATS
+	{ 'G', 0, cmdgrade, 0 },						// Trainer statistics
+#endif
+	{ '0', 0, yacktoggle, CONFLOCK },				// Lock changes
+	{ 'E', CMDTX | CMDMACRO, cmdplay, 1 },			// Playback Macro 1
+	{ 'I', CMDTX | CMDMACRO, cmdplay, 2 },			// Playback Macro 2
+	{ 'T', CMDTX | CMDMACRO, cmdplay, 3 },			// Playback Macro 3
+	{ 'M', CMDTX | CMDMACRO, cmdplay, 4 },			// Playback Macro 4
+	{ 'W', 0, cmdwpm, 0 },							// Query WPM
+#ifdef LATSTATS
+	{ 'Q', 0, cmdstats, 0 },						// Query latency statistics
+#endif
+};
+
+#define		NCOMMANDS		(sizeof(commands) / sizeof(commands[0]))
+
 void commandmode(void)
 /*! 
  @brief     Command mode
@@ -342,6 +863,9 @@ void commandmode(void)
 
 	char c;				// Character from Morse key
 	word timer;          // Exit timer
+	byte i;				// Index into the command table
+	byte flags;			// Flags of the command
+	void (*handler)(byte);	// Handler of the command
 
 	yackinhibit(ON); 		// Sidetone = on, Keyer = off
 
@@ -357,153 +881,89 @@ void commandmode(void)
 
 		yackbeat();
 
-		lfsr(255);        // Keep seeding the LFSR so we get different callsigns
-
-		if (!yackflag(CONFLOCK)) // No Configuration lock?
-				{
-			switch (c) // These are the lockable configuration commands
-			{
-
-			case 'R': // Reset
-				yackreset();
-				c = TRUE;
-				break;
-
-			case 'A': // IAMBIC A
-				yackmode(IAMBICA);
-				c = TRUE;
-				break;
-
-			case 'B': // IAMBIC B
-				yackmode(IAMBICB);
-				c = TRUE;
-				break;
-
-			case 'L': // ULTIMATIC
-				yackmode(ULTIMATIC);
-				c = TRUE;
-				break;
-
-			case 'D': // DAHPRIO
-				yackmode(DAHPRIO);
-				c = TRUE;
-				break;
+		yackrandom(0);	// The operator's timing stirs the generator as well
 
-			case 'X': // Paddle swapping
-				yacktoggle(PDLSWAP);
-				c = TRUE;
-				break;
+		if (!c)
+			continue;
 
-			case 'S': // Sidetone toggle
-				yacktoggle(SIDETONE);
-				c = TRUE;
+		for (i = 0; i < NCOMMANDS; i++) // Look the command up
+			if (pgm_read_byte(&commands[i].letter) == c)
 				break;
 
-			case 'K': // TX keying toggle
-				yacktoggle(TXKEY);
-				c = TRUE;
-				break;
+		if (i < NCOMMANDS)
+			flags = pgm_read_byte(&commands[i].flags);
 
-			case 'Z': // Farnsworth pause
-				setfarns();
-				c = TRUE;
-				break;
-
-			case 'F': // TX level inverter toggle
-				yacktoggle(TXINV);
-				c = TRUE;
-				break;
+		// Unknown, or a configuration command while the configuration is locked?
+		if (i == NCOMMANDS || ((flags & CMDLOCK) && yackflag(CONFLOCK))) {
+			yackerror();
+			continue;
+		}
 
-			case '1': // Record Macro 1
-				yackchar('1');
-				yackmessage(RECORD, 1);
-				c = TRUE;
-				break;
+		handler = (void (*)(byte)) pgm_read_ptr(&commands[i].handler);
 
-			case '2': // Record Macro 2
-				yackchar('2');
-				yackmessage(RECORD, 2);
-				c = TRUE;
-				break;
+		if (flags & CMDTX)
+			yackinhibit(OFF);
 
-			case 'N': // Automatic Beacon
-				beacon(RECORD);
-				c = TRUE;
-				break;
+		handler(pgm_read_byte(&commands[i].arg));
 
-			}
+		if (flags & CMDTX)
+			yackinhibit(ON);
 
+		if (flags & CMDMACRO)
+			timer = YACKSECS(MACTIMEOUT);
+		else {
+			yacksave(); //Save any non-volatile changes to EEPROM
+			yackdelay(DAHLEN * 3); //Eliminate runon txok on some commands
+			yackstring(txok);
 		}
 
-		switch (c) // Commands that can be used anytime
-		{
-
-		case 'V': // Version
-			yackstring(vers);
-			c = TRUE;
-			break;
+	}
 
-		case 'P': // Pitch
-			pitch();
-			c = TRUE;
-			break;
+	yackstring(prgx); 			// Sign off
 
-		case 'U': // Tune
-			yackinhibit(OFF);
-			yacktune();
-			yackinhibit(ON);
-			c = TRUE;
-			break;
+	yackinhibit(OFF);		// Back to normal mode
 
-		case 'C': // Callsign training
-			cstrain();
-			c = TRUE;
-			break;
+}
 
-		case '0': // Lock changes
-			yacktoggle(CONFLOCK);
-			c = TRUE;
-			break;
+#ifdef SERIALIN
 
-		case 'E': // Playback Macro 1
-			yackinhibit(OFF);
-			yackmessage(PLAY, 1);
-			yackinhibit(ON);
-			timer = YACKSECS(MACTIMEOUT);
-			c = FALSE;
-			break;
+void serialsend(void)
+/*! 
+ @brief     Sends the type-ahead text from the serial input
+ 
+ Characters received on the serial input are sent at the current speed, like a message
+ from memory, until the buffer runs empty. A press of the command key stops sending and
+ discards the rest of the buffer.
+ 
+ @see main
+ 
+ */
+{
 
-		case 'I': // Playback Macro 2
-			yackinhibit(OFF);
-			yackmessage(PLAY, 2);
-			yackinhibit(ON);
-			timer = YACKSECS(MACTIMEOUT);
-			c = FALSE;
-			break;
+	char c;
 
-		case 'W': // Query WPM
-			yacknumber(yackwpm());
-			c = TRUE;
-			break;
+	if (!(c = yackrx())) // Nothing to send?
+		return;
 
-		}
+	do {
 
-		if (c == TRUE) // If c still contains a string, the command was not handled properly
+		if (yackctrlkey(FALSE)) // Command key stops sending
 		{
-			yacksave(); //Save any non-volatile changes to EEPROM
-			yackdelay(DAHLEN * 3); //Eliminate runon txok on some commands
-			yackstring(txok);
-		} else if (c)
-			yackerror();
+			while (yackrx())
+				; // Discard the rest
+			return;
+		}
 
-	}
+		yackchar(c);
 
-	yackstring(prgx); 			// Sign off
+	} while ((c = yackrx()));
 
-	yackinhibit(OFF);		// Back to normal mode
+	yackwait();
 
 }
 
+#endif
+
 int main(void)
 /*! 
  @brief     Trivial main routine
@@ -515,6 +975,10 @@ int main(void)
  */
 {
 
+#ifdef SERIALOUT
+	char c;
+#endif
+
 	yackinit(); 					// Initialize YACK hardware
 
 	yackinhibit(ON); //side tone greeting to confirm the unit is alive and kicking
@@ -528,8 +992,19 @@ int main(void)
 			commandmode();
 
 		yackbeat();
+
+#ifdef SERIALIN
+		serialsend(); // Send text typed ahead on the serial input
+#endif
+
 		beacon(PLAY); // Play beacon if requested
+
+#ifdef SERIALOUT
+		if ((c = yackiambic(ON))) // Stream what is keyed, with word gaps
+			yacktx(c);
+#else
 		yackiambic(OFF);
+#endif
 
 	}
 
@@ -0,0 +1,62 @@
+/*!
+ @file      sim/avr/eeprom.h
+ @brief     Host simulation stand-in for <avr/eeprom.h>
+
+ EEMEM variables are ordinary RAM on the host, initialized like the .eep file would be.
+ Writes let simulated time pass like the real EEPROM does (about 3.4 ms per byte).
+ */
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM
+
+uint8_t sim_eeread(const void *p);
+void sim_eewrite(void *p, uint8_t value, uint8_t update);
+uint8_t sim_eeready(void);
+
+#define eeprom_read_byte(p)		sim_eeread(p)
+#define eeprom_write_byte(p, v)	sim_eewrite(p, v, 0)
+#define eeprom_update_byte(p, v)	sim_eewrite(p, v, 1)
+#define eeprom_is_ready()		sim_eeready()
+#define eeprom_busy_wait()		do {} while (!eeprom_is_ready())
+
+static inline uint16_t eeprom_read_word(const uint16_t *p)
+{
+	return sim_eeread(p) | (sim_eeread((const uint8_t *)p + 1) << 8);
+}
+
+static inline void eeprom_write_word(uint16_t *p, uint16_t v)
+{
+	sim_eewrite(p, v, 0);
+	sim_eewrite((uint8_t *)p + 1, v >> 8, 0);
+}
+
+static inline void eeprom_update_word(uint16_t *p, uint16_t v)
+{
+	sim_eewrite(p, v, 1);
+	sim_eewrite((uint8_t *)p + 1, v >> 8, 1);
+}
+
+static inline void eeprom_read_block(void *d, const void *s, size_t n)
+{
+	while (n--)
+		*(uint8_t *)d++ = sim_eeread(s++);
+}
+
+static inline void eeprom_write_block(const void *s, void *d, size_t n)
+{
+	while (n--)
+		sim_eewrite(d++, *(const uint8_t *)s++, 0);
+}
+
+static inline void eeprom_update_block(const void *s, void *d, size_t n)
+{
+	while (n--)
+		sim_eewrite(d++, *(const uint8_t *)s++, 1);
+}
+
+#endif
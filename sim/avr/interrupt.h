@@ -0,0 +1,18 @@
+/*!
+ @file      sim/avr/interrupt.h
+ @brief     Host simulation stand-in for <avr/interrupt.h>
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+void sim_sei(void);
+void sim_cli(void);
+
+#define sei()		sim_sei()
+#define cli()		sim_cli()
+
+// Interrupt vectors become plain functions which the simulator calls
+#define ISR(vector)	void vector(void); void vector(void)
+
+#endif
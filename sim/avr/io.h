@@ -0,0 +1,99 @@
+/*!
+ @file      sim/avr/io.h
+ @brief     Host simulation stand-in for <avr/io.h>
+
+ Declares the ATtiny85 I/O registers used by the keyer as plain variables which
+ are modelled by sim.c. Reading the input port and the watchdog control register
+ goes through the simulator so that busy waiting loops let simulated time pass,
+ and so does TIFR, where writing a one clears a flag like on the chip.
+ */
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+uint8_t sim_pinb(void);
+volatile uint8_t *sim_wdtcr(void);
+volatile uint8_t *sim_tifr(void);
+
+#define PINB		(sim_pinb())
+#define WDTCR		(*sim_wdtcr())
+#define TIFR		(*sim_tifr())
+
+extern volatile uint8_t PORTB, DDRB;
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+extern volatile uint8_t TCCR1, TCNT1, OCR1A, OCR1B, OCR1C;
+extern volatile uint8_t TIMSK, GIMSK, GIFR, PCMSK;
+extern volatile uint8_t CLKPR;
+extern volatile uint8_t SREG;
+
+// Status register
+#define SREG_I		7
+
+// Port B
+#define PB0			0
+#define PB1			1
+#define PB2			2
+#define PB3			3
+#define PB4			4
+#define PB5			5
+
+// Timer0
+#define WGM00		0
+#define WGM01		1
+#define COM0B0		4
+#define COM0B1		5
+#define COM0A0		6
+#define COM0A1		7
+#define CS00		0
+#define CS01		1
+#define CS02		2
+#define WGM02		3
+
+// Timer1
+#define CS10		0
+#define CS11		1
+#define CS12		2
+#define CS13		3
+#define PWM1A		6
+#define CTC1		7
+
+// TIMSK / TIFR
+#define TOIE0		1
+#define OCIE0B		3
+#define OCIE0A		4
+#define TOIE1		2
+#define OCIE1B		5
+#define OCIE1A		6
+#define TOV0		1
+#define OCF0B		3
+#define OCF0A		4
+#define TOV1		2
+#define OCF1B		5
+#define OCF1A		6
+
+// Watchdog
+#define WDP0		0
+#define WDP1		1
+#define WDP2		2
+#define WDE			3
+#define WDCE		4
+#define WDP3		5
+#define WDIE		6
+#define WDIF		7
+
+// System clock prescaler
+#define CLKPCE		7
+
+// Pin change interrupt
+#define PCIE		5
+#define PCIF		5
+#define PCINT0		0
+#define PCINT1		1
+#define PCINT2		2
+#define PCINT3		3
+#define PCINT4		4
+#define PCINT5		5
+
+#endif
@@ -0,0 +1,19 @@
+/*!
+ @file      sim/avr/pgmspace.h
+ @brief     Host simulation stand-in for <avr/pgmspace.h>
+
+ Flash tables are ordinary constant data on the host.
+ */
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)					(s)
+#define pgm_read_byte(p)		(*(const uint8_t *)(p))
+#define pgm_read_word(p)		(*(const uint16_t *)(p))
+#define pgm_read_ptr(p)			(*(void * const *)(p))
+
+#endif
@@ -0,0 +1,23 @@
+/*!
+ @file      sim/avr/sleep.h
+ @brief     Host simulation stand-in for <avr/sleep.h>
+ */
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE			0
+#define SLEEP_MODE_ADC			1
+#define SLEEP_MODE_PWR_DOWN		2
+
+extern uint8_t sim_sleepmode;
+
+void sim_sleep(void);
+
+#define set_sleep_mode(mode)	(sim_sleepmode = (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_bod_disable()
+#define sleep_cpu()				sim_sleep()
+
+#endif
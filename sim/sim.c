@@ -0,0 +1,610 @@
+/*!
+ 
+ @file      sim.c
+ @brief     Host simulation of the keyer hardware
+ 
+ This builds main.c and yack.c for the host (make host) against the stand-in AVR
+ headers in this directory. It models the parts of the ATtiny85 the keyer uses:
+ Timer1 (heartbeat), Timer0 (sidetone in CTC or PWM mode), the pin change interrupt,
+ sleep modes, the watchdog, the system clock prescaler and the EEPROM write time.
+ 
+ This is a timing harness only. The keyer code itself runs in zero simulated time, so
+ the results show how the timers, interrupts and blocking calls shape the keying, not
+ how many cycles the code takes on the AVR, and a tick can not be overrun by slow code.
+ 
+ Usage: yacksim [-w wpm] [-q] script
+ 
+ -w wpm     Keying speed stored in EEPROM before start (default: EEPROM default)
+ -q         Do not print the trace, only the summary
+ 
+ The script lists paddle and button events, one per line, with the time in ms:
+ 
+     # squeeze an A, then tap the command button
+     1000 dit down
+     1000 dah down
+     1150 dit up
+     1150 dah up
+     3000 btn down
+     3100 btn up
+     6000 end
+ 
+ Lines starting with # are ignored. Without "end", the simulation stops 3 seconds
+ after the last event.
+ 
+ The scripts in sim/tests are timing regression checks, run by make simtest.
+ 
+ The trace lists the events and every transition of the TX key line and the sidetone.
+ The summary reports:
+ 
+ - Latency from each paddle closure to the following key down
+ - Timing error of dits, dahs and inter-element gaps on the TX key line against the
+   configured speed (with SHAPEDTONE, the tone also includes the fall ramp)
+ - The number of heartbeat ticks, and how many of them came while the keyer was held
+   in a blocking wait (EEPROM write, delay or polling loop) instead of idle sleep
+ - The share of time spent in idle sleep and in power down (standby or full), and the
+   number of watchdog wakeups
+ - The speed in the newest valid settings record, which the keyer comes up with after
+   a power cycle
+ 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include "yack.h"
+
+#define		MAXEVENTS		20000
+#define		OSC				(F_CPU * 8ULL)	// F_CPU is the 8 MHz oscillator divided by 8
+#define		EEWRITE			(OSC / 1000 * 34 / 10)	// 3.4 ms per EEPROM byte
+
+#define		INT_PCINT0		0x01	// Pending interrupts, in order of priority
+#define		INT_T1COMPA		0x02
+#define		INT_T0OVF		0x04
+#define		INT_T1COMPB		0x08
+#define		INT_WDT			0x10
+#define		WDTCLK			128000	// Watchdog oscillator in Hz
+
+// I/O registers
+
+volatile uint8_t PORTB, DDRB;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+volatile uint8_t TCCR1, TCNT1, OCR1A, OCR1B, OCR1C;
+volatile uint8_t TIMSK, GIMSK, GIFR, PCMSK;
+volatile uint8_t CLKPR = 3;			// CKDIV8 fuse
+volatile uint8_t SREG;				// Only the I flag is modelled
+// WDTCR goes through sim_wdtcr, so that writing a one to WDIF can clear the flag
+static uint8_t wdtcr;			// Control bits of WDTCR
+static uint8_t wdif;			// Watchdog interrupt flag
+static uint8_t wdtio;			// WDTCR as the keyer reads and writes it
+static uint8_t wdtshown;		// What wdtio held when the keyer was given access
+// TIFR goes through sim_tifr as well, as writing a one clears a flag
+static uint8_t tifr;			// Timer interrupt flags
+static uint8_t tifrio;			// TIFR as the keyer reads and writes it
+static uint8_t tifrshown;		// What tifrio held when the keyer was given access
+
+uint8_t sim_sleepmode;
+
+// Provided by the keyer. Vectors it does not implement are skipped.
+
+int yackmain(void);
+extern byte cfgring[CFGSLOTS][CFGSIZE];
+
+void PCINT0_vect(void) __attribute__((weak));
+void TIM1_COMPA_vect(void) __attribute__((weak));
+void TIM0_OVF_vect(void) __attribute__((weak));
+void TIM1_COMPB_vect(void) __attribute__((weak));
+void WDT_vect(void) __attribute__((weak));
+
+// Simulator state
+
+struct event {
+	uint64_t t;		// Time in cycles
+	uint8_t pin;	// Input pin
+	uint8_t level;	// 0 = closed (pulled to GND)
+};
+
+static struct event events[MAXEVENTS];
+static int nevents, nextevent;
+
+static uint64_t now;		// Simulated time in oscillator cycles
+static uint64_t clk;		// CPU clock cycles, which drive the timers
+static uint8_t clkps = 3;	// System clock prescaler (2^clkps)
+static uint64_t endtime;	// End of simulation
+static uint8_t pending;		// Pending interrupts
+static uint8_t sleeping;	// CPU in sleep mode
+static uint8_t woken;		// An interrupt was serviced during sleep
+static uint8_t pins = 0xFF;	// Input levels, all pulled up
+static uint64_t eebusy;		// EEPROM busy until this time
+static uint64_t wdtstart;	// Start of the current watchdog period
+static const char *pdstate;	// Power down state last printed in the trace
+static int quiet;
+
+// Observed outputs and statistics
+
+static const unsigned presc[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 }; // Timer0 clock select
+
+static uint8_t keystate, tonestate;
+static uint64_t keyedge;			// Time of the last TX key line transition
+static uint64_t latstart;			// Paddle closure waiting for a key down
+static uint64_t latmax, latsum;
+static unsigned latn;
+static double errmax[3];			// Dit, dah, gap timing error in %
+static unsigned errn[3];
+static unsigned long ticks, blocked;
+static uint64_t idletime, pdtime;	// Time spent in idle sleep and in power down
+static unsigned long wdtwakes;		// Watchdog interrupts
+static uint8_t ticked;				// Tick serviced since the last idle sleep
+
+static double ms(uint64_t t)
+{
+	return t * 1000.0 / OSC;
+}
+
+static int savedwpm(void)
+{
+	int i, j, found = -1;
+	byte sum;
+
+	for (i = 0; i < CFGSLOTS; i++) {
+		for (sum = 0, j = 0; j < CFGCHECK; j++)
+			sum += cfgring[i][j];
+		if ((byte)(sum ^ MAGPAT) != cfgring[i][CFGCHECK])
+			continue; // Erased or torn, like cfgload
+		if (found < 0 || (signed char)(cfgring[i][CFGSEQ] - cfgring[found][CFGSEQ]) > 0)
+			found = i;
+	}
+
+	return found < 0 ? 0 : cfgring[found][CFGWPM];
+}
+
+static void finish(void)
+{
+	static const char *names[3] = { "dit", "dah", "gap" };
+	int i;
+
+	printf("\nSummary at %u WPM, %.0f ms simulated\n", (unsigned)yackwpm(), ms(now));
+
+	if (latn)
+		printf("  paddle to key down  max %.3f ms  avg %.3f ms  (%u closures)\n", ms(latmax),
+				ms(latsum / latn), latn);
+
+	for (i = 0; i < 3; i++)
+		if (errn[i])
+			printf("  %s timing error  max %.2f %%  (%u elements)\n", names[i], errmax[i], errn[i]);
+
+	printf("  heartbeat ticks %lu  in blocking waits %lu\n", ticks, blocked);
+	printf("  idle sleep %.1f %%  power down %.1f %%  watchdog wakeups %lu\n", 100.0 * idletime / now,
+			100.0 * pdtime / now, wdtwakes);
+	printf("  saved speed %d WPM\n", savedwpm());
+
+	exit(0);
+}
+
+static void element(uint64_t len, uint8_t mark)
+{
+	double dot = OSC * 1.2 / yackwpm();
+	double n = (double)(uint64_t)(len / dot + 0.5);
+	double err;
+	int i;
+
+	if (n < 1)
+		n = 1;
+
+	if (!mark && n > 1)
+		return; // Character and word gaps depend on the operator
+
+	i = mark ? (n > 2 ? 1 : 0) : 2;
+	err = (len - n * dot) / (n * dot) * 100;
+	if (err < 0)
+		err = -err;
+	if (err > errmax[i])
+		errmax[i] = err;
+	errn[i]++;
+}
+
+static void observe(void)
+{
+	uint8_t key, tone;
+
+	key = (PORTB >> OUTPIN) & 1;
+	tone = (TCCR0B & 0x07) != 0;
+
+	if (key != keystate) {
+		keystate = key;
+		if (!quiet)
+			printf("%10.3f ms  key %s\n", ms(now), key ? "high" : "low");
+
+		if (keyedge)
+			element(now - keyedge, !key);
+		keyedge = now;
+	}
+
+	if (tone != tonestate) {
+		tonestate = tone;
+
+		if (!quiet) {
+			if (tone && (TCCR0A & (1 << WGM00)))
+				printf("%10.3f ms  tone on (shaped)\n", ms(now));
+			else if (tone && presc[TCCR0B & 0x07])
+				printf("%10.3f ms  tone on (%lu Hz)\n", ms(now),
+						(unsigned long)((OSC >> clkps) / (2UL * presc[TCCR0B & 0x07] * (OCR0A + 1))));
+			else
+				printf("%10.3f ms  tone %s\n", ms(now), tone ? "on" : "off");
+		}
+
+		if (tone && latstart) {
+			if (now - latstart > latmax)
+				latmax = now - latstart;
+			latsum += now - latstart;
+			latn++;
+			latstart = 0;
+		}
+	}
+}
+
+static void dispatch(void)
+{
+	if (!(SREG & (1 << SREG_I)))
+		return;
+
+	while (pending && (SREG & (1 << SREG_I))) {
+		SREG &= ~(1 << SREG_I); // Interrupts are disabled while an ISR runs
+
+		if (pending & INT_PCINT0) {
+			pending &= ~INT_PCINT0;
+			GIFR &= ~(1 << PCIF);
+			if (PCINT0_vect)
+				PCINT0_vect();
+		} else if (pending & INT_T1COMPA) {
+			pending &= ~INT_T1COMPA;
+			tifr &= ~(1 << OCF1A);
+			ticks++;
+			if (ticked)
+				blocked++;
+			ticked = 1;
+			if (TIM1_COMPA_vect)
+				TIM1_COMPA_vect();
+		} else if (pending & INT_T0OVF) {
+			pending &= ~INT_T0OVF;
+			tifr &= ~(1 << TOV0);
+			if (TIM0_OVF_vect)
+				TIM0_OVF_vect();
+		} else if (pending & INT_T1COMPB) {
+			pending &= ~INT_T1COMPB;
+			tifr &= ~(1 << OCF1B);
+			if ((TIMSK & (1 << OCIE1B)) && TIM1_COMPB_vect) // Not if disabled since the match
+				TIM1_COMPB_vect();
+		} else if (pending & INT_WDT) {
+			pending &= ~INT_WDT;
+			wdif = 0;
+			wdtwakes++;
+			if (WDT_vect)
+				WDT_vect();
+		}
+
+		SREG |= (1 << SREG_I);
+		woken = 1;
+	}
+}
+
+static void timer1(void)
+{
+	uint8_t cs = TCCR1 & 0x0F;
+
+	if (!cs || (clk & ((1UL << (cs - 1)) - 1)))
+		return; // Stopped or no prescaled clock edge
+
+	if ((TCCR1 & (1 << CTC1)) && TCNT1 == OCR1C)
+		TCNT1 = 0;
+	else
+		TCNT1++;
+
+	if (TCNT1 == OCR1A) {
+		tifr |= (1 << OCF1A);
+		if (TIMSK & (1 << OCIE1A))
+			pending |= INT_T1COMPA;
+	}
+
+	if (TCNT1 == OCR1B) {
+		tifr |= (1 << OCF1B);
+		if (TIMSK & (1 << OCIE1B))
+			pending |= INT_T1COMPB;
+	}
+}
+
+static void timer0(void)
+{
+	unsigned p = presc[TCCR0B & 0x07];
+
+	if (!p || clk % p)
+		return; // Stopped or no prescaled clock edge
+
+	if ((TCCR0A & ((1 << WGM01) | (1 << WGM00))) == (1 << WGM01)) { // CTC mode
+		if (TCNT0 == OCR0A)
+			TCNT0 = 0;
+		else
+			TCNT0++;
+	} else if (!++TCNT0) { // Normal and fast PWM mode overflow at 0xFF
+		tifr |= (1 << TOV0);
+		if (TIMSK & (1 << TOIE0))
+			pending |= INT_T0OVF;
+	}
+}
+
+static void watchdog(void)
+{
+	uint8_t wdp = (wdtcr & 0x07) | ((wdtcr >> (WDP3 - 3)) & 0x08);
+
+	if (!(wdtcr & (1 << WDIE))) {
+		wdtstart = now; // Stopped, the next period starts when it is switched on
+		return;
+	}
+
+	if ((now - wdtstart) * WDTCLK >= (2048ULL << wdp) * OSC) {
+		wdtstart = now;
+		wdif = 1;
+		pending |= INT_WDT;
+	}
+}
+
+static void wdtsync(void)
+{
+	if (wdtio != wdtshown) { // The keyer wrote WDTCR
+		if (wdtio & (1 << WDIF)) {
+			wdif = 0; // Writing a one clears the flag
+			pending &= ~INT_WDT;
+		}
+		wdtcr = wdtio & ~(1 << WDIF);
+	}
+
+	wdtio = wdtshown = wdtcr | (wdif << WDIF);
+}
+
+static void tifrsync(void)
+{
+	if (tifrio != tifrshown) { // The keyer wrote TIFR, each one clears its flag
+		tifr &= ~tifrio;
+		if (tifrio & (1 << OCF1A))
+			pending &= ~INT_T1COMPA;
+		if (tifrio & (1 << OCF1B))
+			pending &= ~INT_T1COMPB;
+		if (tifrio & (1 << TOV0))
+			pending &= ~INT_T0OVF;
+	}
+
+	tifrio = tifrshown = tifr;
+}
+
+static void cycle(void)
+{
+	uint8_t changed;
+
+	wdtsync();
+	tifrsync();
+
+	if ((CLKPR & 0x0F) != clkps) { // The keyer wrote the timed sequence in zero time
+		clkps = CLKPR & 0x0F;
+		if (!quiet)
+			printf("%10.3f ms  clock %lu Hz\n", ms(now), (unsigned long)(OSC >> clkps));
+	}
+
+	now += 1 << clkps;
+	clk++;
+
+	if (sleeping)
+		*(sim_sleepmode == SLEEP_MODE_PWR_DOWN ? &pdtime : &idletime) += 1 << clkps;
+
+	while (nextevent < nevents && events[nextevent].t <= now) {
+		struct event *e = &events[nextevent++];
+
+		changed = (pins >> e->pin) & 1;
+		if (e->level)
+			pins |= (1 << e->pin);
+		else
+			pins &= ~(1 << e->pin);
+		changed ^= (pins >> e->pin) & 1;
+
+		if (!quiet)
+			printf("%10.3f ms  %s %s\n", ms(now), e->pin == DITPIN ? "dit" :
+					e->pin == DAHPIN ? "dah" : "btn", e->level ? "up" : "down");
+
+		if (!e->level && e->pin != BTNPIN && !latstart)
+			latstart = now;
+
+		pdstate = NULL; // Print the next power down again
+
+		if (changed && (PCMSK & (1 << e->pin))) {
+			GIFR |= (1 << PCIF);
+			if (GIMSK & (1 << PCIE))
+				pending |= INT_PCINT0;
+		}
+	}
+
+	if (!(sleeping && sim_sleepmode == SLEEP_MODE_PWR_DOWN)) { // The timers stop in power down
+		timer0();
+		timer1();
+	}
+
+	watchdog(); // Runs in all sleep modes
+
+	if (now >= endtime)
+		finish();
+
+	observe();
+	dispatch();
+}
+
+uint8_t sim_pinb(void)
+{
+	cycle(); // Busy waiting loops poll the port, so let time pass
+
+	return (pins & ~DDRB) | (PORTB & DDRB);
+}
+
+volatile uint8_t *sim_tifr(void)
+{
+	tifrsync();
+
+	return &tifrio;
+}
+
+volatile uint8_t *sim_wdtcr(void)
+{
+	cycle(); // Polling the watchdog flag lets time pass as well
+	wdtsync();
+
+	return &wdtio;
+}
+
+void sim_sei(void)
+{
+	// Like SEI, this takes effect after the next instruction. A pending interrupt
+	// is serviced by the next cycle, or wakes up sleep_cpu right away.
+	SREG |= (1 << SREG_I);
+}
+
+void sim_cli(void)
+{
+	SREG &= ~(1 << SREG_I);
+}
+
+void sim_sleep(void)
+{
+	wdtsync();
+
+	if (sim_sleepmode == SLEEP_MODE_IDLE)
+		ticked = 0; // Back in idle sleep, the keyer waits for the next tick
+
+	if (sim_sleepmode == SLEEP_MODE_PWR_DOWN) {
+		const char *state = (wdtcr & (1 << WDIE)) ? "standby" : "power down";
+
+		if (state != pdstate && !quiet)
+			printf("%10.3f ms  %s\n", ms(now), state);
+		pdstate = state;
+	}
+
+	sleeping = 1;
+	woken = 0;
+
+	dispatch();
+
+	while (!woken)
+		cycle();
+
+	sleeping = 0;
+}
+
+void sim_delay(unsigned long n)
+{
+	while (n--)
+		cycle();
+}
+
+uint8_t sim_eeready(void)
+{
+	return now >= eebusy;
+}
+
+uint8_t sim_eeread(const void *p)
+{
+	while (!sim_eeready())
+		cycle();
+
+	return *(const uint8_t *)p;
+}
+
+void sim_eewrite(void *p, uint8_t value, uint8_t update)
+{
+	while (!sim_eeready())
+		cycle();
+
+	if (update && *(uint8_t *)p == value)
+		return; // eeprom_update_* skips unchanged bytes
+
+	*(uint8_t *)p = value;
+	eebusy = now + EEWRITE;
+}
+
+static void setwpm(int n)
+{
+	byte *rec = cfgring[0]; // The initial settings record
+	byte sum = 0;
+	int i;
+
+	rec[CFGWPM] = n;
+
+	for (i = 0; i < CFGCHECK; i++)
+		sum += rec[i];
+
+	rec[CFGCHECK] = sum ^ MAGPAT;
+}
+
+static void readscript(const char *name)
+{
+	FILE *f;
+	char line[100], pin[10], level[10];
+	double t;
+	int n;
+
+	if (!(f = fopen(name, "r"))) {
+		perror(name);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		n = sscanf(line, "%lf %9s %9s", &t, pin, level);
+
+		if (n >= 2 && !strcmp(pin, "end")) {
+			endtime = t * OSC / 1000;
+			continue;
+		}
+
+		if (n != 3 || nevents == MAXEVENTS) {
+			fprintf(stderr, "%s: bad line: %s", name, line);
+			exit(1);
+		}
+
+		events[nevents].t = t * OSC / 1000;
+		events[nevents].pin = !strcmp(pin, "dit") ? DITPIN : !strcmp(pin, "dah") ? DAHPIN : BTNPIN;
+		events[nevents].level = strcmp(level, "down") != 0;
+		nevents++;
+	}
+
+	fclose(f);
+
+	if (!endtime)
+		endtime = (nevents ? events[nevents - 1].t : 0) + 3 * OSC;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-w"))
+			setwpm(atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-q"))
+			quiet = 1;
+		else
+			break;
+	}
+
+	if (i != argc - 1) {
+		fprintf(stderr, "Usage: %s [-w wpm] [-q] script\n", argv[0]);
+		return 1;
+	}
+
+	readscript(argv[i]);
+
+	yackmain(); // Never returns, the simulation ends in finish()
+
+	return 0;
+}
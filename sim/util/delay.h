@@ -0,0 +1,14 @@
+/*!
+ @file      sim/util/delay.h
+ @brief     Host simulation stand-in for <util/delay.h>
+ */
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+void sim_delay(unsigned long cycles);
+
+#define _delay_ms(ms)	sim_delay((unsigned long)((ms) * (F_CPU / 1000)))
+#define _delay_us(us)	sim_delay((unsigned long)((us) * (F_CPU / 1000000)))
+
+#endif
@@ -0,0 +1,239 @@
+# Flash, RAM and stack budget of the keyer build, see "make budget" in the Makefile.
+#
+# Input files, in this order:
+#   avr-size -A main.elf		section sizes
+#   avr-objdump -t main.elf		symbols, to tell functions from tables and variables
+#   avr-objdump -d main.elf		disassembly, for the calls between functions
+#   *.su						stack frames from gcc -fstack-usage
+#
+# Variables (-v):
+#   mcu		the target chip, selects the limits below
+#   icall	functions that can be reached through a function pointer (icall)
+#
+# The report goes to stdout, one tab separated record per line:
+#   mcu		<name>
+#   flash	<used> <limit>				.text + .data
+#   sram	<used> <limit>				.data + .bss + .noinit
+#   eeprom	<used> <limit>
+#   stack	main <bytes> <call path>	deepest call chain from main
+#   stack	isr <bytes> <call path>		deepest interrupt handler
+#   ram		<used> <limit>				sram + both stacks
+#   func	<name> <flash> <frame>		per function, frame from .su (- if unknown)
+#   table	<name> <flash>				per object in flash (PROGMEM)
+#   var		<name> <sram>				per variable in RAM
+#   ee		<name> <eeprom>				per object in EEPROM
+#
+# A summary and any exceeded limit is printed to stderr. The exit status is 1 if a limit
+# is exceeded, or if a divide routine of the C library (__udivmodhi4 and the like) is
+# linked, as the keyer divides with yackdiv instead.
+#
+# Stack depths are static: each call adds its return address (2 bytes) and the frame of
+# the callee. Library functions without a .su entry count with their return address only.
+
+function hex(s,    i, n, c)
+{
+	n = 0;
+	s = tolower(s);
+	for (i = 1; i <= length(s); i++) {
+		c = index("0123456789abcdef", substr(s, i, 1));
+		if (!c)
+			break;
+		n = n * 16 + c - 1;
+	}
+	return n;
+}
+
+function depth(f,    i, n, d, best, g, cost)
+{
+	if (f in memo)
+		return memo[f];
+	if (f in busy) { # Recursion, the static depth is unbounded
+		recursive[f] = 1;
+		return 0;
+	}
+	busy[f] = 1;
+
+	best = 0;
+	path[f] = f;
+	n = ncalls[f];
+	for (i = 1; i <= n; i++) {
+		g = callee[f, i];
+		cost = (tail[f, i] ? 0 : 2) + depth(g);
+		if (cost > best) {
+			best = cost;
+			path[f] = f ">" path[g];
+		}
+	}
+
+	delete busy[f];
+	memo[f] = frame[f] + best;
+	return memo[f];
+}
+
+function edge(f, g, jmp,    i)
+{
+	for (i = 1; i <= ncalls[f]; i++)
+		if (callee[f, i] == g)
+			return;
+	i = ++ncalls[f];
+	callee[f, i] = g;
+	tail[f, i] = jmp;
+}
+
+BEGIN {
+	FS = "[ \t]+";
+
+	# Flash, SRAM and EEPROM of the supported chips
+	split("attiny25 2048 128 128 attiny45 4096 256 256 attiny85 8192 512 512 " \
+		"attiny24 2048 128 128 attiny44 4096 256 256 attiny84 8192 512 512 " \
+		"attiny24a 2048 128 128 attiny44a 4096 256 256 attiny84a 8192 512 512", lim, " ");
+	for (i = 1; i in lim; i += 4) {
+		flashmax[lim[i]] = lim[i + 1];
+		rammax[lim[i]] = lim[i + 2];
+		eemax[lim[i]] = lim[i + 3];
+	}
+	if (!(mcu in flashmax)) {
+		print "budget: no limits known for " mcu > "/dev/stderr";
+		exit 2;
+	}
+
+	n = split(icall, icalls, " ");
+	file = 0;
+}
+
+FNR == 1 {
+	file++;
+}
+
+# avr-size -A: section sizes
+file == 1 && NF >= 2 && $1 ~ /^\./ {
+	sect[$1] = $2;
+	next;
+}
+
+# avr-objdump -t: the divide routines of libgcc
+file == 2 && $NF ~ /^__u?divmod(q|h|ps|s)i4$/ {
+	divlib[$NF] = 1;
+}
+
+# avr-objdump -t: "addr flags... F|O section size name"
+file == 2 && NF >= 5 && ($(NF - 3) == "F" || $(NF - 3) == "O") {
+	name = $NF;
+	size = hex($(NF - 1));
+	if ($(NF - 3) == "F") {
+		isfunc[name] = 1;
+		fsize[name] = size;
+	} else if (size) {
+		osect[name] = $(NF - 2);
+		osize[name] = size;
+	}
+	next;
+}
+
+# avr-objdump -d: function headers and the calls and jumps to other functions
+file == 3 && /^[0-9a-f]+ <[^>]+>:$/ {
+	cur = $2;
+	gsub(/[<>:]/, "", cur);
+	next;
+}
+
+file == 3 && /[ \t]e?icall([ \t]|$)/ {
+	for (i = 1; i <= n; i++)
+		edge(cur, icalls[i], 0);
+	next;
+}
+
+file == 3 && /[ \t]r?(call|jmp)[ \t]/ && /<[^>+]+>$/ {
+	g = $NF;
+	gsub(/[<>]/, "", g);
+	if (g != cur)
+		edge(cur, g, $0 ~ /[ \t]r?jmp[ \t]/);
+	next;
+}
+
+# gcc -fstack-usage: "file.c:line:col:name bytes static|dynamic|bounded"
+file >= 4 {
+	split($0, su, "\t");
+	name = su[1];
+	sub(/.*:/, "", name);
+	frame[name] = su[2];
+	if (su[3] != "static")
+		dynamic[name] = su[3];
+	next;
+}
+
+END {
+	if (!(mcu in flashmax))
+		exit 2;
+
+	# Only calls made by functions count, tables get disassembled as well
+	for (f in ncalls)
+		if (!(f in isfunc))
+			delete ncalls[f];
+
+	flash = sect[".text"] + sect[".data"];
+	sram = sect[".data"] + sect[".bss"] + sect[".noinit"];
+	eeprom = sect[".eeprom"] + 0;
+
+	mainstack = 2 + depth("main"); # main is called from the startup code
+	mainpath = path["main"];
+
+	isrstack = 0;
+	isrpath = "-";
+	for (f in isfunc)
+		if (f ~ /^__vector_/ && 2 + depth(f) > isrstack) {
+			isrstack = 2 + depth(f);
+			isrpath = path[f];
+		}
+
+	ram = sram + mainstack + isrstack;
+
+	OFS = "\t";
+	print "mcu", mcu;
+	print "flash", flash, flashmax[mcu];
+	print "sram", sram, rammax[mcu];
+	print "eeprom", eeprom, eemax[mcu];
+	print "stack", "main", mainstack, mainpath;
+	print "stack", "isr", isrstack, isrpath;
+	print "ram", ram, rammax[mcu];
+
+	for (f in isfunc)
+		print "func", f, fsize[f], (f in frame) ? frame[f] : "-";
+	for (o in osize) {
+		if (osect[o] == ".text")
+			print "table", o, osize[o];
+		else if (osect[o] == ".eeprom")
+			print "ee", o, osize[o];
+		else
+			print "var", o, osize[o];
+	}
+
+	printf "%s: flash %d/%d, RAM %d/%d (%d static, stack %d + %d in interrupts), EEPROM %d/%d\n", \
+		mcu, flash, flashmax[mcu], ram, rammax[mcu], sram, mainstack, isrstack, \
+		eeprom, eemax[mcu] > "/dev/stderr";
+	print "deepest call chain: " mainpath > "/dev/stderr";
+
+	for (f in dynamic)
+		print "budget: warning, " f " has a " dynamic[f] " stack frame" > "/dev/stderr";
+	for (f in recursive)
+		print "budget: warning, " f " is recursive, its stack depth is not bounded" > "/dev/stderr";
+
+	fail = 0;
+	if (flash > flashmax[mcu]) {
+		print "budget: flash exceeded by " flash - flashmax[mcu] " bytes" > "/dev/stderr";
+		fail = 1;
+	}
+	if (ram > rammax[mcu]) {
+		print "budget: RAM exceeded by " ram - rammax[mcu] " bytes" > "/dev/stderr";
+		fail = 1;
+	}
+	if (eeprom > eemax[mcu]) {
+		print "budget: EEPROM exceeded by " eeprom - eemax[mcu] " bytes" > "/dev/stderr";
+		fail = 1;
+	}
+	for (f in divlib) {
+		print "budget: " f " is linked, a division is left that yackdiv should do" > "/dev/stderr";
+		fail = 1;
+	}
+	exit fail;
+}
@@ -0,0 +1,194 @@
+/*!
+
+ @file      mkdict.c
+ @brief     Packs the word lists of the dictionary trainer for the keyer
+
+ Reads plain word lists, one word per line, and writes a header with the packed
+ dictionaries as PROGMEM tables to stdout (see the dict.h rule in the Makefile).
+ Empty lines and lines starting with # are left out. Words may only contain the
+ letters A-Z (lower case is converted) and the digits 0-9, as the trainer scores
+ per character.
+
+ Usage: mkdict name file [name file ...] > dict.h
+
+ Each word is stored as 5 bit symbols, the most significant bit first:
+
+ - 1..26    the letters A-Z
+ - 27 n     the digit n, in the following symbol
+ - 0        end of the word
+
+ To find a word without decoding the whole dictionary, an index holds the bit
+ position of every DICTSTEP-th word. A dictionary holds up to 255 words, so that
+ yackrandom can pick one.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define		DICTSTEP		16		// Words between two entries of the index
+#define		DICTMAXLEN		8		// Longest word, the size of the trainer buffer
+#define		DICTWORDS		255		// Most words in a dictionary
+#define		DICTDIGIT		27		// Symbol in front of a digit
+
+static unsigned char bits[DICTWORDS * (DICTMAXLEN * 2 + 1) * 5 / 8 + 2];
+static unsigned long nbits;
+
+static void put(unsigned sym)
+/*!
+ @brief     Appends a 5 bit symbol to the packed dictionary
+
+ @param sym    The symbol, 0..31
+ */
+{
+	int i;
+
+	for (i = 4; i >= 0; i--, nbits++)
+		if (sym & (1 << i))
+			bits[nbits / 8] |= 0x80 >> (nbits % 8);
+}
+
+static void pack(const char *name, const char *file)
+/*!
+ @brief     Packs one word list and writes its table and index
+
+ @param name    Name of the dictionary, used for the C identifiers
+ @param file    The word list
+ */
+{
+	FILE *f;
+	char line[256];
+	char *p;
+	char *e;
+	unsigned index[DICTWORDS / DICTSTEP + 1];
+	int words = 0;
+	int lineno = 0;
+	unsigned long i;
+
+	if (!(f = fopen(file, "r"))) {
+		perror(file);
+		exit(1);
+	}
+
+	memset(bits, 0, sizeof(bits));
+	nbits = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		for (p = line; isspace((unsigned char) *p); p++)
+			;
+		for (e = p + strlen(p); e > p && isspace((unsigned char) e[-1]); e--)
+			;
+		*e = '\0';
+
+		if (!*p || *p == '#') // Empty line or comment
+			continue;
+
+		if (e - p > DICTMAXLEN) {
+			fprintf(stderr, "%s:%d: %s is longer than %d characters\n", file, lineno, p,
+					DICTMAXLEN);
+			exit(1);
+		}
+
+		if (words == DICTWORDS) {
+			fprintf(stderr, "%s:%d: more than %d words\n", file, lineno, DICTWORDS);
+			exit(1);
+		}
+
+		if (!(words % DICTSTEP))
+			index[words / DICTSTEP] = nbits;
+		words++;
+
+		for (; *p; p++) {
+			if (isalpha((unsigned char) *p))
+				put(toupper((unsigned char) *p) - 'A' + 1);
+			else if (isdigit((unsigned char) *p)) {
+				put(DICTDIGIT);
+				put(*p - '0');
+			} else {
+				fprintf(stderr, "%s:%d: '%c' can not be trained\n", file, lineno, *p);
+				exit(1);
+			}
+		}
+
+		put(0); // End of the word
+	}
+
+	fclose(f);
+
+	if (!words) {
+		fprintf(stderr, "%s: no words\n", file);
+		exit(1);
+	}
+
+	if (nbits > 0xFFFF) {
+		fprintf(stderr, "%s: too large for the index\n", file);
+		exit(1);
+	}
+
+	printf("// %s: %d words in %lu bytes\n", file, words, (nbits + 7) / 8);
+	printf("const byte dict%s[] PROGMEM = {", name);
+	for (i = 0; i < (nbits + 7) / 8 + 1; i++) // A spare byte, as symbols are read 16 bits at a time
+		printf("%s0x%02X", i % 12 ? ", " : (i ? ",\n\t" : "\n\t"), bits[i]);
+	printf("\n};\n");
+
+	printf("const word dict%sidx[] PROGMEM = {", name);
+	for (i = 0; i <= (unsigned long) (words - 1) / DICTSTEP; i++)
+		printf("%s%u", i % 8 ? ", " : (i ? ",\n\t" : "\n\t"), index[i]);
+	printf("\n};\n");
+	printf("#define\t\tDICTN%s\t\t%d\n\n", name, words);
+}
+
+int main(int argc, char **argv)
+/*!
+ @brief     Writes the header with all dictionaries given on the command line
+
+ @return    0 if successful, 1 if a word list could not be packed
+ */
+{
+	int i;
+	char *p;
+
+	if (argc < 3 || !(argc & 1)) {
+		fprintf(stderr, "Usage: %s name file [name file ...] > dict.h\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i += 2)
+		for (p = argv[i]; *p; p++)
+			if (!isalnum((unsigned char) *p)) {
+				fprintf(stderr, "%s: %s is no valid name\n", argv[0], argv[i]);
+				return 1;
+			}
+
+	printf("// Dictionaries of the trainer, generated by tools/mkdict. Do not edit.\n\n");
+	printf("#define\t\tDICTSTEP\t\t%d\t// Words between two entries of an index\n", DICTSTEP);
+	printf("#define\t\tDICTMAXLEN\t\t%d\t// Longest word\n", DICTMAXLEN);
+	printf("#define\t\tDICTDIGIT\t\t%d\t// Symbol in front of a digit\n\n", DICTDIGIT);
+
+	for (i = 1; i < argc; i += 2)
+		pack(argv[i], argv[i + 1]);
+
+	printf("const struct dictionary dicts[] PROGMEM = {\n");
+	for (i = 1; i < argc; i += 2)
+		printf("\t{ dict%s, dict%sidx, DICTN%s },\n", argv[i], argv[i], argv[i]);
+	printf("};\n");
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+# Timing check of a yacksim run, see "make simtest" in the Makefile.
+#
+# Input files, in this order:
+#   sim/tests/<name>.txt		the script, with "# Expect at <wpm> WPM:" lines
+#   yacksim -q -w <wpm> output	the summary of the run (- for stdin)
+#
+# Variables (-v):
+#   wpm		the speed of the run, selects the Expect line of the script
+#   tol		the largest dit, dah and gap timing error allowed, in %
+#
+# An Expect line lists the number of dits, dahs and gaps inside characters the keyer
+# has to send, e.g. "# Expect at 25 WPM: dit 29 dah 18 gap 44". It can also list the
+# speed at the end of the run (wpm), the speed in the settings saved to EEPROM (saved),
+# the number of paddle closures keyed (closures) and the longest time in ms from a
+# closure to the key going down (latency, an upper limit). The run fails if a value
+# differs or a timing error is above tol. One line with the result goes to stdout,
+# and the exit status is 1 if the run failed.
+
+FNR == NR {
+	if ($0 ~ "^# Expect at " wpm " WPM:")
+		for (i = 6; i < NF; i += 2) {
+			want[$i] = $(i + 1) + 0;
+			wanted++;
+		}
+	next;
+}
+
+/timing error/ {
+	got[$1] = substr($7, 2) + 0; # "(20 elements)"
+	err[$1] = $5 + 0;
+}
+
+/^Summary at/ {
+	got["wpm"] = $3 + 0;
+}
+
+/saved speed/ {
+	got["saved"] = $3 + 0;
+}
+
+/paddle to key down/ {
+	got["latency"] = $6 + 0;
+	got["closures"] = substr($11, 2) + 0; # "(35 closures)"
+}
+
+END {
+	name = ARGV[1];
+	sub(".*/", "", name);
+	msg = "";
+
+	for (e in want)
+		if (!(e in got))
+			msg = msg " no " e;
+		else if (e == "latency" ? got[e] > want[e] : got[e] != want[e])
+			msg = msg " " e " " got[e] (e == "latency" ? " above " : " not ") want[e];
+
+	for (e in err)
+		if (err[e] > tol + 0)
+			msg = msg " " e " error " err[e] " %";
+
+	if (!wanted)
+		msg = " nothing expected at " wpm " WPM";
+
+	if (msg) {
+		printf("%s at %s WPM:%s\n", name, wpm, msg);
+		exit 1;
+	}
+
+	printf("%s at %s WPM: ok\n", name, wpm);
+}
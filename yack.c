@@ -42,8 +42,80 @@
 
 // Forward declaration of private functions
 static void key(byte mode);
+static void txline(byte mode);
+static void txkey(byte mode);
+#ifdef WEIGHTING
+static byte beatpos(void);
+static void wtarm(void);
+static void wtfire(void);
+#endif
+#ifdef PTT
+static void ptttick(void);
+#endif
 static char morsechar(byte buffer);
 static void keylatch(void);
+static void speedcalc(void);
+static void playqueue(byte element);
+static void playtick(void);
+static void playstop(void);
+static byte playbreak(void);
+static byte playwait(byte room);
+static byte cfgcheck(const byte *rec);
+static void cfgfill(byte *rec);
+static void cfgapply(const byte *rec);
+static byte cfgload(void);
+static void cfgcommit(byte wait);
+static void msgremove(byte start, byte size);
+struct msgreader;
+static char msgget(struct msgreader *rd);
+#ifdef MSGMACROS
+static byte msgnumber(struct msgreader *rd, byte digits);
+#endif
+static void ctrldelay(void);
+static byte numsend(word n, byte width, byte cut);
+#ifdef TIMESTAMPS
+static word timestamp(void);
+#endif
+#ifdef PCICAPTURE
+static byte pdlcapture(void);
+#endif
+#ifdef STRAIGHTKEY
+static char straightkey(byte ctrl);
+#endif
+static word gaplimit(byte wordend);
+#ifdef GAPLEARN
+static void gaplearn(word idle);
+#endif
+#ifdef CLOCKPROFILE
+static void clockset(byte fast);
+static void clockprofile(void);
+#endif
+#ifdef POWERSAVE
+static void wdtset(byte secs);
+#endif
+#ifdef RANDOMSEED
+static void rndseed(void);
+#endif
+#if !defined(FIXEDMODE) || FIXEDMODE == IAMBICA || FIXEDMODE == IAMBICB
+static void idleiambic(void);
+#endif
+#if !defined(FIXEDMODE) || FIXEDMODE == ULTIMATIC
+static void idleultimatic(void);
+#endif
+#if !defined(FIXEDMODE) || FIXEDMODE == DAHPRIO
+static void idledahprio(void);
+#endif
+#if !defined(FIXEDMODE) || FIXEDMODE != IAMBICB
+static void keyedignore(void);
+#endif
+#ifndef FIXEDMODE
+static void modeset(void);
+#endif
+#if defined(SERIALIN) || defined(SERIALOUT)
+static word sernext(word t, byte n);
+static byte serahead(word t);
+static byte serschedule(void);
+#endif
 
 // Enumerations
 
@@ -56,27 +128,203 @@ enum FSMSTATE {
 // Module local definitions
 
 static byte yackflags;		// Permanent (stored) status of module flags
+static byte yackopts;		// Permanent (stored) options, see yackoption
 static byte volflags = 0;		// Temporary working flags (volatile)
 static word ctcvalue;		// Pitch
 static word wpmcnt;			// Speed
 static byte wpm;            // Real wpm
+static byte wpmhold = 0;	// Keyer speed set aside by yackwpmhold, 0 if none
 static byte farnsworth;     // Additional Farnsworth pause
+static byte weight;			// Mark/space ratio in %
+static byte comp;			// Compensation in ms
+static volatile byte beats = 0;	// Heartbeat ticks signalled by the Timer1 ISR
+static volatile word seconds = 0;	// Seconds clock, see yacktime
+static byte secbeats = 0;		// Heartbeats into the current second
+static byte lastsymbol = 0;		// The last element sent by yackiambic (DITLATCH or DAHLATCH)
+static byte ultimem = 0;		// The last single paddle in Ultimatic mode
+static word rndstate = 0xACE1;	// State of the xorshift generator in yackrandom, never 0
+
+#ifdef GAPLEARN
+#define		GAPFIX			16	// Gap averages are kept in 1/GAPFIX dots
+static word gapchr = 2 * GAPFIX;	// Average idle time between characters
+static word gapwrd = 8 * GAPFIX;	// Average idle time between words
+#endif
+
+// Paddle latching of the keyer mode in the IDLE and KEYED states of yackiambic. Selected
+// by modeset when the mode changes, or fixed at compile time with FIXEDMODE.
+#ifndef FIXEDMODE
+static void (*idlemode)(void) = idleiambic;
+static void (*keyedmode)(void) = keylatch;
+#elif FIXEDMODE == IAMBICA
+static void (* const idlemode)(void) = idleiambic;
+static void (* const keyedmode)(void) = keyedignore;
+#elif FIXEDMODE == IAMBICB
+static void (* const idlemode)(void) = idleiambic;
+static void (* const keyedmode)(void) = keylatch;
+#elif FIXEDMODE == ULTIMATIC
+static void (* const idlemode)(void) = idleultimatic;
+static void (* const keyedmode)(void) = keyedignore;
+#elif FIXEDMODE == DAHPRIO
+static void (* const idlemode)(void) = idledahprio;
+static void (* const keyedmode)(void) = keyedignore;
+#else
+#error FIXEDMODE must be IAMBICA, IAMBICB, ULTIMATIC or DAHPRIO
+#endif
+
+#ifdef POWERSAVE
+static byte wdtsecs = 0;		// Watchdog period in seconds, 0 if off
+static word alarmtime;			// Wakeup time requested with yackalarm
+static byte alarmset = FALSE;	// TRUE if alarmtime is valid for this pass
+#endif
+
+#ifdef SHAPEDTONE
+static volatile word tonestep;	// Sine phase step per sample, TONESTEP(ctcvalue)
+static word stepctc = 0;		// ctcvalue that tonestep was computed for
+static volatile byte toneup = FALSE;	// TRUE while key() holds the tone on
+static volatile byte rampcnt = RAMPCNT;	// Samples per envelope level at the current clock
+#endif
+
+#ifdef CLOCKPROFILE
+static byte clockfast = FALSE;	// TRUE while running at CLKFACTOR * F_CPU
+static word clockhold = 0;		// Beats until the clock drops back to F_CPU
+#endif
+
+#ifdef TIMESTAMPS
+static volatile word beatclock = 0;	// Heartbeat ticks since power up, for time stamps
+#endif
+
+#define		PDLMASK			((1 << DITPIN) | (1 << DAHPIN)) // Paddle bits in KEYINP
+
+#ifdef PCICAPTURE
+#define		DEBOUNCECNT		(BEATCLK * PCIDEBOUNCE / 1000) // PCIDEBOUNCE in Timer1 counts
+#define		STALECNT		(2 * BEATCNT)	// Age at which keylatch drops a capture
+
+static volatile byte pcilatch = 0;	// Paddle closures captured by the ISR (KEYINP bits)
+static volatile word pcistamp;	// Time stamp of the first closure in pcilatch
+#ifdef STRAIGHTKEY
+static volatile word pciedge;	// Time stamp of the last paddle edge
+#endif
+#endif
+
+#ifdef SERIALIN
+static char rxbuf[RXSIZE];			// Received characters
+static volatile byte rxhead = 0;	// Index of the next free slot, written by the ISR
+static byte rxtail = 0;				// Index of the next character to read
+static volatile byte rxbits;		// Data bits of the current character sampled so far
+static word rxnext;					// Timer1 count at which the next bit is sampled
+#endif
+
+#ifdef SERIALOUT
+static char txbuf[TXSIZE];			// Characters waiting to be sent
+static byte txhead = 0;				// Index of the next free slot
+static volatile byte txtail = 0;	// Index of the next character to send, written by the ISR
+static volatile byte txbits = 0;	// Bit periods left of the current character, 0 when idle
+static word txnext;					// Timer1 count at which the next bit starts
+#endif
+
+#ifdef LATSTATS
+static word latstart;		// Time stamp of the paddle closure waiting to be keyed
+static byte latpending = 0;	// TRUE while latstart waits for key(DOWN)
+static word latmax = 0;		// Worst latency in Timer1 counts
+static word latsum = 0;		// Sum of the latencies counted in latcount
+static word latcount = 0;	// Number of latencies recorded
+static word overruns = 0;	// Ticks that had already arrived when yackbeat was called
+#endif
+
+// Playback engine. Each queued element is a number of dot lengths, with PQMARK set
+// if the key is down for its duration. The heartbeat plays them back one tick at a time.
+
+#define		PQMARK			0x80	// Element is a mark (keyed), not a gap
+#define		PQDOTS			0x7F	// Element length in dot lengths
+
+static byte playq[PQSIZE];	// Queued elements
+static byte pqhead = 0;		// Index of the next element to play
+static byte pqtail = 0;		// Index of the next free slot
+static word pqtimer = 0;	// Beats left in the element being played
+static byte pqkeyed = 0;	// TRUE while playback holds the key down
+static byte keydown = FALSE;	// TRUE while key() holds the key down
+
+#ifdef WEIGHTING
+// Weighting of the TX marks. The edge of the key line that makes a mark longer (or shorter)
+// is held back by wtcnt Timer1 counts. wtarm sets compare match B to it in the heartbeat it
+// falls into, or with WTROUND, txkey sets it on the nearest heartbeat.
+#if defined(TINY84) && (defined(SERIALIN) || defined(SERIALOUT))
+#define		WTROUND			// Compare match B is taken by the serial bits
+#endif
+static int16_t wtcnt = 0;		// Timer1 counts added to every mark, negative shortens it
+static volatile byte wtedge = 0;	// Held back edge of the key line (UP or DOWN), 0 if none
+static int16_t wtleft;			// Timer1 counts from the last heartbeat tick to wtedge
+#endif
+
+#ifdef PTT
+// PTT sequencer. key() only asks for the key line, and ptttick replays the requests of the
+// last PTTBEATS heartbeats, delayed by PTTBEATS, onto the key line.
+#define		PTTMASK			((word)((1UL << PTTBEATS) - 1))
+#define		PTTOUT			((word)1 << (PTTBEATS - 1))	// The bit on the key line
+static byte txwant = FALSE;	// Key line as asked for by key()
+static word txhist = 0;		// Key line asked for in the last PTTBEATS beats, bit 0 the newest
+static byte txhang = 0;		// Beats left until PTT drops
+#endif
+
+// Settings store. yacksave prepares the next record in cfgrec, and the heartbeat writes
+// it into the ring one byte per tick while the keyer is idle.
+
+static byte cfgrec[CFGSIZE];	// Newest settings record
+static byte cfgslot = 0;		// Slot of cfgrec in the ring
+static byte cfgpos = CFGSIZE;	// Next byte of cfgrec to write, CFGSIZE if committed
+
+// Check value of a record with the default settings and sequence number 0
+#define		CFGDEFCHECK		(MAGPAT ^ (((FLAGDEFAULT) + (DEFCTC & 0xFF) + (DEFCTC >> 8) + DEFWPM + OPTDEFAULT \
+							+ DEFWEIGHT + DEFCOMP) & 0xFF))
 
 // EEPROM Data
 
-byte magic EEMEM = MAGPAT;	// Needs to contain 'A5' if mem is valid
-byte flagstor EEMEM = FLAGDEFAULT;	//	Defaults
-word ctcstor EEMEM = DEFCTC;	// Pitch = 800Hz
-byte wpmstor EEMEM = DEFWPM;	// 15 WPM
-byte fwstor EEMEM = 0; // No farnsworth pause
+byte cfgring[CFGSLOTS][CFGSIZE] EEMEM = // Settings journal, slot 0 holds the defaults
+{
+	{ 0, FLAGDEFAULT, DEFCTC & 0xFF, DEFCTC >> 8, DEFWPM, 0, OPTDEFAULT, DEFWEIGHT, DEFCOMP, CFGDEFCHECK }
+};
 word user1 EEMEM = 0; // User storage
 word user2 EEMEM = 0; // User storage
+#ifdef PROFILES
+byte profiles[PROFILES][CFGSIZE] EEMEM; // Setting profiles, empty until stored
+#endif
+
+// Messages. msgdir holds the start offset of each message in msgpool and its length in
+// characters. The messages are packed without gaps from the start of msgpool, in any order.
+
+#define		MSGCODE(c)		((c) - ' ')	// 6 bit code of a character
+#define		MSGPACK(a, b, c, d)	(MSGCODE(a) << 2) | (MSGCODE(b) >> 4), \
+							((MSGCODE(b) & 0x0F) << 4) | (MSGCODE(c) >> 2), \
+							((MSGCODE(c) & 0x03) << 6) | MSGCODE(d)
+
+byte msgdir[MSGCOUNT][2] EEMEM = { { 0, 4 }, { 3, 4 }, { 6, 4 }, { 9, 4 } };
+byte msgpool[MSGPOOL] EEMEM = {
+	MSGPACK('M', 'S', 'G', '1'), MSGPACK('M', 'S', 'G', '2'),
+	MSGPACK('M', 'S', 'G', '3'), MSGPACK('M', 'S', 'G', '4')
+};
+
+#if MSGPOOL > 255
+#error MSGPOOL offsets must fit into a byte
+#endif
 
-char eebuffer1[100] EEMEM = "message 1";
-char eebuffer2[100] EEMEM = "message 2";
+//! Read position in a stored message, see msgget
+struct msgreader {
+	byte pos;		//!< Next pool byte to read
+	byte left;		//!< Characters left in the message
+	byte nbits;		//!< Number of bits pending in bits
+	word bits;		//!< Bit stream, the lower nbits are pending
+};
 
 // Flash data
 
+#define		NUMDIGITS		5		// Digits of a word
+
+//! Powers of ten for the digits of a number, see numsend
+const word numpowers[NUMDIGITS] PROGMEM = { 10000, 1000, 100, 10, 1 };
+
+//! Cut numbers: 0, 1 and 9 are abbreviated to T, A and N
+const char cutdigits[10] PROGMEM = "TA2345678N";
+
 //! Morse code table in Flash
 
 //! Encoding: Each byte is read from the left. 0 stands for a dot, 1
@@ -89,78 +337,126 @@ char eebuffer2[100] EEMEM = "message 2";
 //!           .-
 //!             | This is the stop marker (1 with all trailing zeros)
 
-const byte morse[] PROGMEM =
-{
-
-	0b11111100, // 0
-	0b01111100,// 1
-	0b00111100,// 2
-	0b00011100,// 3
-	0b00001100,// 4
-	0b00000100,// 5
-	0b10000100,// 6
-	0b11000100,// 7
-	0b11100100,// 8
-	0b11110100,// 9
-	0b01100000,// A
-	0b10001000,// B
-	0b10101000,// C
-	0b10010000,// D
-	0b01000000,// E
-	0b00101000,// F
-	0b11010000,// G
-	0b00001000,// H
-	0b00100000,// I
-	0b01111000,// J
-	0b10110000,// K
-	0b01001000,// L
-	0b11100000,// M
-	0b10100000,// N
-	0b11110000,// O
-	0b01101000,// P
-	0b11011000,// Q
-	0b01010000,// R
-	0b00010000,// S
-	0b11000000,// T
-	0b00110000,// U
-	0b00011000,// V
-	0b01110000,// W
-	0b10011000,// X
-	0b10111000,// Y
-	0b11001000,// Z
-	0b00110010,// ?
-	0b01010110,// .
-	0b10010100,// /
-	0b11101000,// ! (American Morse version, commonly used in ham circles)
-	0b11001110,// ,
-	0b11100010,// :
-	0b10101010,// ;
-	0b01001010,// "
-	0b00010011,// $
-	0b01111010,// ' (Apostrophe)
-	0b10110100,// ( or [ (also prosign KN)
-	0b10110110,// ) or ]
-	0b10000110,// - (Hyphen or single dash)
-	0b01101010,// @
-	0b00110110,// _ (Underline)
-	0b01010010,// Paragaraph break symbol
-	0b10001100,// = and BT
-	0b00010110,// SK
-	0b01010100,// + and AR
-	0b10001011,// BK
-	0b01000100,// AS
-	0b10101100,// KA (also ! in alternate Continental Morse)
-	0b00010100,// VE
-	0b01011000// AA
-};
+//! The table is defined once below as a list of character / code pairs. The
+//! flash tables for sending and decoding are generated from it by the preprocessor.
+
+#define MORSEALNUM(X) \
+	X('0', 0b11111100) \
+	X('1', 0b01111100) \
+	X('2', 0b00111100) \
+	X('3', 0b00011100) \
+	X('4', 0b00001100) \
+	X('5', 0b00000100) \
+	X('6', 0b10000100) \
+	X('7', 0b11000100) \
+	X('8', 0b11100100) \
+	X('9', 0b11110100) \
+	X('A', 0b01100000) \
+	X('B', 0b10001000) \
+	X('C', 0b10101000) \
+	X('D', 0b10010000) \
+	X('E', 0b01000000) \
+	X('F', 0b00101000) \
+	X('G', 0b11010000) \
+	X('H', 0b00001000) \
+	X('I', 0b00100000) \
+	X('J', 0b01111000) \
+	X('K', 0b10110000) \
+	X('L', 0b01001000) \
+	X('M', 0b11100000) \
+	X('N', 0b10100000) \
+	X('O', 0b11110000) \
+	X('P', 0b01101000) \
+	X('Q', 0b11011000) \
+	X('R', 0b01010000) \
+	X('S', 0b00010000) \
+	X('T', 0b11000000) \
+	X('U', 0b00110000) \
+	X('V', 0b00011000) \
+	X('W', 0b01110000) \
+	X('X', 0b10011000) \
+	X('Y', 0b10111000) \
+	X('Z', 0b11001000)
+
+// The special characters can not be decoded without defining their content.
+// # stands for SK, + for AR. To add new characters, add them at the end of this list.
+// All characters must be in the range 0x20 to 0x5F (see morsecode).
+
+#define MORSESPECIAL(X) \
+	X('?', 0b00110010) \
+	X('.', 0b01010110) \
+	X('/', 0b10010100) \
+	X('!', 0b11101000) /* American Morse version, commonly used in ham circles */ \
+	X(',', 0b11001110) \
+	X(':', 0b11100010) \
+	X(';', 0b10101010) \
+	X('"', 0b01001010) /* Quotation mark */ \
+	X('$', 0b00010011) \
+	X('^', 0b01111010) /* ' (Apostrophe) */ \
+	X('(', 0b10110100) /* ( or [ (also prosign KN) */ \
+	X(')', 0b10110110) /* ) or ] */ \
+	X('-', 0b10000110) /* Hyphen or single dash */ \
+	X('@', 0b01101010) \
+	X('_', 0b00110110) /* Underline */ \
+	X('\\', 0b01010010) /* Paragraph break symbol */ \
+	X('=', 0b10001100) /* = and BT */ \
+	X('#', 0b00010110) /* SK */ \
+	X('+', 0b01010100) /* + and AR */ \
+	X('*', 0b10001011) /* BK */ \
+	X('%', 0b01000100) /* AS */ \
+	X('&', 0b10101100) /* KA (also ! in alternate Continental Morse) */ \
+	X('<', 0b00010100) /* VE */ \
+	X('>', 0b01011000) /* AA */
+
+#define MORSEENCODE(c, m)	[(c) - ' '] = m,
+
+//! Encode table, indexed by ASCII code from 0x20 (space) to 0x5F (underline).
+//! Lower case characters are folded onto this range. Unused entries are 0.
+
+const byte morsecode[64] PROGMEM = { MORSEALNUM(MORSEENCODE) MORSESPECIAL(MORSEENCODE) };
+
+#if DECODEMAP == 256
+
+//! Reverse map for morsechar, directly indexed by the code byte.
+#define MORSEDECODE(c, m)	[m] = c,
+
+const char morsemap[256] PROGMEM = { MORSEALNUM(MORSEDECODE) MORSESPECIAL(MORSEDECODE) };
+
+#elif DECODEMAP == 128
+
+//! Reverse map for morsechar, indexed by the code byte shifted right by one. This holds all
+//! codes of up to 6 elements (bit 0 clear). The few 7 element codes are parked in entry 0,
+//! which no valid code can reach, and are found by scanning the table instead.
+#define MORSEDECODE(c, m)	[((m) & 1) ? 0 : (m) >> 1] = ((m) & 1) ? 0 : c,
+
+const char morsemap[128] PROGMEM = { MORSEALNUM(MORSEDECODE) MORSESPECIAL(MORSEDECODE) };
+
+#endif
 
-// The special characters at the end of the above table can not be decoded
-// without a small table to define their content. # stands for SK, $ for AR
+#ifdef SHAPEDTONE
 
-// To add new characters, add them in the code table above at the end and below
-// Do not forget to increase the legth of the array..
+//! PWM duty cycles of the shaped sidetone, one sine period for each envelope level k = 1 .. 8:
+//! 255 * (1 - cos(pi * k / 8)) / 2 * (1 + sin(2 * pi * i / 16)) / 2. The sine rides on a
+//! DC level that rises and falls with it, so that switching the output on and off at level 0
+//! does not click.
 
-const char spechar[24] PROGMEM = "?./!,:;~$^()-@_|=#+*%&<>";
+#if RAMPSTEPS != 8 || TONESAMPLES != 16
+#error tonetab must be recomputed for RAMPSTEPS and TONESAMPLES
+#endif
+
+const byte tonetab[RAMPSTEPS][TONESAMPLES] PROGMEM =
+{
+	{   5,   7,   8,   9,  10,   9,   8,   7,   5,   3,   1,   0,   0,   0,   1,   3 },
+	{  19,  26,  32,  36,  37,  36,  32,  26,  19,  12,   5,   1,   0,   1,   5,  12 },
+	{  39,  54,  67,  76,  79,  76,  67,  54,  39,  24,  12,   3,   0,   3,  12,  24 },
+	{  64,  88, 109, 123, 127, 123, 109,  88,  64,  39,  19,   5,   0,   5,  19,  39 },
+	{  88, 122, 150, 170, 176, 170, 150, 122,  88,  54,  26,   7,   0,   7,  26,  54 },
+	{ 109, 150, 186, 209, 218, 209, 186, 150, 109,  67,  32,   8,   0,   8,  32,  67 },
+	{ 123, 170, 209, 236, 245, 236, 209, 170, 123,  76,  36,   9,   0,   9,  36,  76 },
+	{ 128, 176, 218, 245, 255, 245, 218, 176, 128,  79,  37,  10,   0,  10,  37,  79 }
+};
+
+#endif
 
 // Functions
 
@@ -174,15 +470,24 @@ void yackreset(void)
 
  This function resets all YACK EEPROM settings to their default values as 
  stored in the .h file. It sets the dirty flag and calls the save routine
- to write the data into EEPROM immediately.
+ to write the data into EEPROM as soon as the keyer is idle.
  */
 {
 
 	ctcvalue = DEFCTC; // Initialize to 800 Hz
 	wpm = DEFWPM; // Init to default speed
-	wpmcnt = (1200 / YACKBEAT) / DEFWPM; // default speed
+	weight = DEFWEIGHT;
+	comp = DEFCOMP;
+	speedcalc(); // default speed
 	farnsworth = 0; // No Farnsworth gap
 	yackflags = FLAGDEFAULT;
+	yackopts = OPTDEFAULT;
+#ifndef FIXEDMODE
+	modeset();
+#endif
+#ifdef MSGMACROS
+	yackuser(WRITE, 2, 0); // Serial numbers start over at 001
+#endif
 
 	volflags |= DIRTYFLAG;
 	yacksave(); // Store them in EEPROM
@@ -200,33 +505,39 @@ void yackinit(void)
  */
 {
 
-	byte magval;
-
 	// Configure DDR. Make OUT and ST output ports
 	SETBIT(OUTDDR, OUTPIN);
 	SETBIT(STDDR, STPIN);
+#ifdef PTT
+	SETBIT(PTTDDR, PTTPIN);
+#endif
 
 	// Raise internal pullups for all inputs
 	SETBIT(KEYPORT, DITPIN);
 	SETBIT(KEYPORT, DAHPIN);
 	SETBIT(BTNPORT, BTNPIN);
 
-	magval = eeprom_read_byte(&magic); // Retrieve magic value
-
-	if (magval == MAGPAT) // Is memory valid
+	if (cfgload()) // Is there a valid settings record?
 	{
-		ctcvalue = eeprom_read_word(&ctcstor); // Retrieve last ctc setting
-		wpm = eeprom_read_byte(&wpmstor); // Retrieve last wpm setting
-		wpmcnt = (1200 / YACKBEAT) / wpm; // Calculate speed
-		farnsworth = eeprom_read_byte(&fwstor); // Retrieve last wpm setting	
-		yackflags = eeprom_read_byte(&flagstor); // Retrieve last flags	
+		cfgapply(cfgrec);
 	} else {
 		yackreset();
 	}
 
 	yackinhibit(OFF);
 
-#ifdef POWERSAVE
+#ifdef SERIALIN
+	SETBIT(RXPORT, RXPIN); // Pullup, an open input reads as idle line
+	SETBIT(CTSDDR, CTSPIN); // CTS low, ready to receive
+	PCMSK0 |= (1 << RXPIN); // A start bit raises the pin change interrupt
+#endif
+
+#ifdef SERIALOUT
+	SETBIT(TXPORT, TXPIN); // Idle line is high
+	SETBIT(TXDDR, TXPIN);
+#endif
+
+#if defined(POWERSAVE) || defined(PCICAPTURE) || defined(SERIALIN)
 #ifdef TINY85
 	PCMSK |= PWRWAKE;    // Define which keys wake us up
 	GIMSK |= (1 << PCIE);  // Enable pin change interrupt
@@ -239,845 +550,3263 @@ void yackinit(void)
 	// Initialize timer1 to serve as the system heartbeat
 	// CK runs at 1MHz. Prescaling by 64 makes that 15625 Hz.
 	// Counting 78 cycles of that generates an overflow every 5ms
+	// (with FINETIMING the count is trimmed to the keying speed in speedcalc)
 
 #ifdef TINY85
 	OCR1C = 78; // 77 counts per cycle
 	TCCR1 |= (1 << CTC1) | 0b00000111; // Clear Timer on match, prescale ck by 64
 	OCR1A = 1; // CTC mode does not create an overflow so we use OCR1A
+	TIMSK |= (1 << OCIE1A); // Compare match A raises the heartbeat interrupt
 #elif defined TINY84
 	OCR1AL = 78; // 77 counts per cycle
 	TCCR1B |= (1 << WGM12) | 0b00000011; // Clear Timer on match, prescale ck by 64
+	TIMSK1 |= (1 << OCIE1A); // Compare match A raises the heartbeat interrupt
 #endif
-}
 
-#ifdef POWERSAVE
+#ifdef SHAPEDTONE
+	// Timer0 only runs while the sidetone sounds. Each overflow computes the next sample.
+#ifdef TINY85
+	TIMSK |= (1 << TOIE0);
+#elif defined TINY84
+	TIMSK0 |= (1 << TOIE0);
+#endif
+#endif
 
-ISR( PCINT0_vect)
-/*! 
- @brief     A dummy pin change interrupt
- 
- This function is called whenever the system is in sleep mode and there is a level change on one of the contacts 
- we are monitoring (dit, dah and the command key). As all handling is already taken care of by polling in the main 
- routines, there is nothing we need to do here.
- */
-{
-	// Nothing to do here. All we want is to wake up..
+	speedcalc(); // Derive the element timing from the stored speed
+
+#ifdef RANDOMSEED
+	rndseed(); // Timer1 is running, interrupts are still off
+#endif
+
+	// Start the first heartbeat afresh. Compare match A has been raised while interrupts
+	// were off and would end it right away.
+	TCNT1 = 0;
+#ifdef TINY85
+	TIFR = (1 << OCF1A);
+#elif defined TINY84
+	TIFR1 = (1 << OCF1A);
+#endif
+
+	sei(); // The heartbeat is interrupt driven from here on
 }
 
-void yackpower(byte n)
+ISR( TIM1_COMPA_vect)
 /*! 
- @brief     Manages the power saving mode
- 
- This is called in yackbeat intervals with either a TRUE or FALSE as parameter. Whenever the
- parameter is TRUE a beat counter is advanced until the timeout level is reached. When timeout
- is reached, the chip shuts down and will only wake up again when issued a level change interrupt on
- either of the input pins.
- 
- When the parameter is FALSE, the counter is reset.
- 
- @param n   TRUE: OK to sleep, FALSE: Can not sleep now
+ @brief     Heartbeat interrupt
  
+ Timer1 raises this interrupt once every YACKBEAT ms. It only signals the tick to yackbeat,
+ which sleeps the CPU in idle mode until this happens. All keyer work is still done in
+ the main context so that the FSM and the playback functions need no locking.
  */
-
 {
-	static uint32_t shdntimer = 0;
-
-	if (n) // True = we could go to sleep
-	{
-		if (shdntimer++ == YACKSECS(PSTIME)) {
-			shdntimer = 0; // So we do not go to sleep right after waking up..
+	beats++;
 
-#ifdef TINY85
-			GIFR |= (1 << PCIF); //Clear interrupt flag
-#elif defined TINY84
-			GIFR |= (1 << PCIF0); //Clear interrupt flag
+#ifdef TIMESTAMPS
+	beatclock++;
 #endif
+}
 
-      set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-			sleep_enable();
-			sleep_bod_disable();
-			sei();
-			sleep_cpu();
-			sleep_disable();
-			cli();
+#ifdef SHAPEDTONE
 
-			// There is no technical reason to CLI here but it avoids hitting the ISR every time
-			// the paddles are touched. If the remaining code needs the interrupts this is OK to remove.
+ISR( TIM0_OVF_vect)
+/*!
+ @brief     Shaped sidetone interrupt
 
-		}
+ Timer0 raises this interrupt at the end of every PWM period while the sidetone sounds.
+ It advances the sine phase by tonestep and sets the duty cycle of the next period from
+ tonetab. Every rampcnt samples the envelope moves one level up while key() holds toneup,
+ or one level down otherwise. Once the tone has faded out, the timer is stopped.
 
-	} else // Passed parameter is FALSE
-	{
-		shdntimer = 0;
+ This runs TONERATE times a second, so it is kept to a table lookup and a few adds.
+ */
+{
+	static word phase = 0;		// Sine phase, one period is 65536
+	static byte level = 0;		// Envelope level, 0 is silent
+	static byte ramp = 1;		// Samples until the next envelope step
+	byte duty = 0;
+
+	phase += tonestep;
+
+	if (!--ramp) {
+		ramp = rampcnt;
+
+		if (toneup) {
+			if (level < RAMPSTEPS)
+				level++;
+		} else if (level)
+			level--;
+		else {
+			TCCR0A = 0; // Faded out, disconnect the pin and stop the timer
+			TCCR0B = 0;
+		}
 	}
 
+	if (level)
+		duty = pgm_read_byte(&tonetab[level - 1][phase / (65536UL / TONESAMPLES)]);
+
+#ifdef TINY85
+	OCR0B = duty;
+#elif defined TINY84
+	OCR0A = duty;
+#endif
 }
 
 #endif
 
-void yacksave(void)
+#ifdef TIMESTAMPS
+
+static word timestamp(void)
 /*! 
- @brief     Saves all permanent settings to EEPROM
+ @brief     Returns a time stamp in Timer1 counts
  
- To save EEPROM write cycles, writing only happens when the flag DIRTYFLAG is set.
- After writing the flag is cleared
+ Combines the heartbeat ticks counted by the ISR with the Timer1 count since the last
+ tick. The result wraps around every 65536 Timer1 counts, which is fine for measuring 
+ intervals of a few seconds.
  
- @callergraph
+ Must be called with interrupts disabled, so that the tick count and TCNT1 match.
+ 
+ This is a private function.
+ 
+ @return    Timer1 counts since power up
  
  */
 {
 
-	if (volflags & DIRTYFLAG) // Dirty flag set?
-	{
+	word t;
+	word cnt;
+	word top;
 
-		eeprom_write_byte(&magic, MAGPAT);
-		eeprom_write_word(&ctcstor, ctcvalue);
-		eeprom_write_byte(&wpmstor, wpm);
-		eeprom_write_byte(&flagstor, yackflags);
-		eeprom_write_byte(&fwstor, farnsworth);
+	t = beatclock;
+	cnt = TCNT1;
 
-		volflags &= ~DIRTYFLAG; // Clear the dirty flag
+#ifdef TINY85
+	if (TIFR & (1 << OCF1A)) // Tick arrived but not yet counted by the ISR?
+	{
+		t++;
+		cnt = TCNT1;
+	}
+
+	// The tick is raised when TCNT1 reaches OCR1A = 1
+	top = OCR1C + 1;
+	cnt = cnt ? cnt - 1 : top - 1;
+#elif defined TINY84
+	if (TIFR1 & (1 << OCF1A))
+	{
+		t++;
+		cnt = TCNT1;
 	}
 
+	// The tick is raised when TCNT1 reaches the top in OCR1A
+	top = OCR1A + 1;
+	cnt = (cnt == OCR1A) ? 0 : cnt + 1;
+#endif
+
+	return t * top + cnt;
+
 }
 
-void yackinhibit(byte mode)
+#endif
+
+#if defined(POWERSAVE) || defined(PCICAPTURE) || defined(SERIALIN)
+
+ISR( PCINT0_vect)
 /*! 
- @brief     Inhibits keying during command phases
+ @brief     Pin change interrupt
  
- This function is used to inhibit and re-enable TX keying (if configured) and enforce the internal 
- sidetone oscillator to be active so that the user can communicate with the keyer.
+ This function is called whenever there is a level change on one of the contacts we are
+ monitoring (dit, dah and the command key). In sleep mode, all we want is to wake up.
  
- @param mode   ON inhibits keying, OFF re-enables keying 
+ With PCICAPTURE, paddle closures are latched in pcilatch together with a time stamp of 
+ the first one, for keylatch to pick up at the next heartbeat. A closure is ignored if 
+ it follows a release by less than PCIDEBOUNCE ms, so that contact bounce does not 
+ produce extra elements.
  
+ With SERIALIN, a falling edge on the serial input starts the reception of a character.
+ The pin change interrupt of that pin stays off until TIM1_COMPB_vect has sampled the
+ stop bit.
  */
 {
+#ifdef SERIALIN
+	if ((PCMSK0 & (1 << RXPIN)) && !(RXINP & (1 << RXPIN))) // Start bit?
+	{
+		PCMSK0 &= ~(1 << RXPIN); // Timer1 samples the rest of the character
 
-	if (mode) {
-		volflags &= ~(TXKEY | SIDETONE);
-		volflags |= SIDETONE;
+		rxnext = sernext(TCNT1, SERBITCNT * 3 / 2); // Middle of the first data bit
+		rxbits = 0;
+		serschedule();
 	}
+#endif
 
-	else
+#ifdef PCICAPTURE
+	static byte open = PDLMASK; // Paddles that were open at the last edge
+	static word released = 0;	// Time stamp of the last release
+	byte pins;
+	byte closed;
+	word t;
 
-	{
-		volflags &= ~(TXKEY | SIDETONE);
-		volflags |= (yackflags & (TXKEY | SIDETONE));
-		key(UP);
-	}
+	t = timestamp();
+	pins = KEYINP & PDLMASK;
+
+	if (pins & ~open) // Any paddle released?
+		released = t;
 
+	closed = open & ~pins; // Paddles closed since the last edge
+#ifdef STRAIGHTKEY
+	if (pins != open)
+		pciedge = t;
+#endif
+	open = pins;
+
+	if (closed && (word)(t - released) >= DEBOUNCECNT) {
+		if (!pcilatch) // First one since keylatch looked?
+			pcistamp = t;
+
+		pcilatch |= closed;
+	}
+#endif
 }
 
-word yackuser(byte func, byte nr, word content)
+#endif
+
+#if defined(SERIALIN) || defined(SERIALOUT)
+
+static word sernext(word t, byte n)
 /*! 
- @brief     Saves user defined settings
- 
- The routine using this library is given the opportunity to save up to two 16 bit sized
- values in EEPROM. In case of the sample main function this is used to store the beacon interval 
- timer value. The routine is not otherwise used by the library.
+ @brief     Adds Timer1 counts to a point in time of the serial bit timing
  
- @param func    States if the data is retrieved (READ) or written (WRITE) to EEPROM
- @param nr      1 or 2 (Number of user storage to access)
- @param content The 16 bit word to write. Not used in read mode.
- @return        The content of the retrieved value in read mode.
+ @param t   A Timer1 count
+ @param n   Timer1 counts to add
+ @return    The sum, wrapped at the top of the heartbeat count in OCR1A
  
  */
 {
 
-	if (func == READ) {
-		if (nr == 1)
-			return (eeprom_read_word(&user1));
-		else if (nr == 2)
-			return (eeprom_read_word(&user2));
-	}
-
-	if (func == WRITE) {
-
-		if (nr == 1)
-			eeprom_write_word(&user1, content);
-		else if (nr == 2)
-			eeprom_write_word(&user2, content);
-	}
+	t += n;
+	if (t > OCR1A) // Past the top of the heartbeat count?
+		t -= OCR1A + 1;
 
-	return (FALSE);
+	return t;
 
 }
 
-word yackwpm(void)
+static byte serahead(word t)
 /*! 
- @brief     Retrieves the current WPM speed
+ @brief     Timer1 counts from now until a point in time of the serial bit timing
  
- This function delivers the current WPM speed. 
-
- @return        Current speed in WPM
+ No bit is ever scheduled more than one and a half bits ahead, so a point in time that
+ appears further ahead than two bits has just passed.
+ 
+ @param t   A Timer1 count
+ @return    Timer1 counts until t, 0 if t has passed
  
  */
 {
 
-	return wpm;
+	word n;
+	word d;
+
+	n = TCNT1;
+	d = (t >= n) ? t - n : t + OCR1A + 1 - n;
+
+	return (d > 2 * SERBITCNT) ? 0 : d;
 
 }
 
-void yackspeed(byte dir, byte mode)
+static byte serschedule(void)
 /*! 
- @brief     Increases or decreases the current WPM speed
+ @brief     Sets compare match B to the next bit of the serial input or output
  
- The amount of increase or decrease is in amounts of wpmcnt. Those are close to real
- WPM in a 10ms heartbeat but can significantly differ at higher heartbeat speeds.
+ The serial input and output share compare match B, which is set to whichever of the
+ two needs it first. It is switched off when neither is busy. Must be called with 
+ interrupts disabled.
  
- @param dir     UP (faster) or DOWN (slower)
+ @return    TRUE if a bit is due right now, compare match B is then left as it is
  
  */
 {
 
-	if (mode == FARNSWORTH) {
-		if ((dir == UP) && (farnsworth > 0))
-			farnsworth--;
+	byte d;
+	byte first = 0xFF;
+	word t = 0;
 
-		if ((dir == DOWN) && (farnsworth < MAXFARN))
-			farnsworth++;
-	} else // WPMSPEED
+#ifdef SERIALIN
+	if (!(PCMSK0 & (1 << RXPIN))) // Receiving?
 	{
-		if ((dir == UP) && (wpm < MAXWPM))
-			wpm++;
-
-		if ((dir == DOWN) && (wpm > MINWPM))
-			wpm--;
+		first = serahead(rxnext);
+		t = rxnext;
+	}
+#endif
 
-		wpmcnt = (1200 / YACKBEAT) / wpm; // Calculate beats
+#ifdef SERIALOUT
+	if (txbits && (d = serahead(txnext)) < first)
+	{
+		first = d;
+		t = txnext;
+	}
+#endif
 
+	if (first == 0xFF) // Neither busy?
+	{
+		TIMSK1 &= ~(1 << OCIE1B);
+		return FALSE;
 	}
 
-	volflags |= DIRTYFLAG; // Set the dirty flag
+	if (first <= 1) // Too close to be sure the match is not missed
+		return TRUE;
 
-	yackplay(DIT);
-	yackdelay(IEGLEN);	// Inter Element gap
-	yackplay(DAH);
-	yackdelay(ICGLEN);	// Inter Character gap
-	yackfarns(); // Additional Farnsworth delay
+	OCR1B = t;
 
-}
+	if (!(TIMSK1 & (1 << OCIE1B)))
+	{
+		TIFR1 = (1 << OCF1B); // Clear a stale match
+		TIMSK1 |= (1 << OCIE1B);
+	}
+
+	return FALSE;
 
-void yackbeat(void)
-/*! 
- @brief     Heartbeat delay
- 
- Several functions in the keyer are timing dependent. The most prominent example is the
- yackiambic function that implements the IAMBIC keyer finite state machine.
- The same expects to be called in intervals of YACKBEAT milliseconds. How this is 
- implemented is left to the user. In a more complex application this would be done
- using an interrupt or a timer. For simpler cases this is a busy wait routine
- that delays exactly YACKBEAT ms.
- 
- */
-{
-#ifdef TINY85
-	while ((TIFR & (1 << OCF1A)) == 0)
-			; // Wait for Timeout
-		TIFR |= (1 << OCF1A);                // Reset output compare flag
-#elif defined TINY84
-	while ((TIFR1 & (1 << OCF1A)) == 0)
-		; // Wait for Timeout
-	TIFR1 |= (1 << OCF1A);                // Reset output compare flag
-#endif
 }
 
-void yackpitch(byte dir)
+ISR( TIM1_COMPB_vect)
 /*! 
- @brief     Increases or decreases the sidetone pitch
+ @brief     Serial bit timing interrupt
  
- Changes are done not in Hz but in ctc control values. This is to avoid extensive 
- calculations at runtime. As is all calculations are done by the preprocessor.
+ With SERIALIN, samples one bit of the character on the serial input in the middle of the
+ bit. After the stop bit, the character is stored in the receive buffer and the pin change
+ interrupt waits for the next start bit. Characters with a framing error or a full 
+ buffer are dropped. CTS is raised once RXHIGH characters are buffered.
  
- @param dir     UP or DOWN
+ With SERIALOUT, sets the serial output to the next bit of the character being sent and
+ takes the next character from the transmit buffer once the stop bit has ended.
  
+ Bits that fall due together are handled in the same call.
  */
 {
-	if (dir == UP)
-		ctcvalue--;
-	if (dir == DOWN)
-		ctcvalue++;
 
-	if (ctcvalue < MAXCTC)
-		ctcvalue = MAXCTC;
+	do {
 
-	if (ctcvalue > MINCTC)
-		ctcvalue = MINCTC;
+#ifdef SERIALIN
+		if (!(PCMSK0 & (1 << RXPIN)) && serahead(rxnext) <= 1)
+		{
+			static byte data;	// Character being received, LSB first
 
-	volflags |= DIRTYFLAG; // Set the dirty flag
+			if (rxbits < 8) // Data bit?
+			{
+				data >>= 1;
+				if (RXINP & (1 << RXPIN))
+					data |= 0x80;
+				rxbits++;
 
-}
+				rxnext = sernext(rxnext, SERBITCNT);
+			} else // Stop bit
+			{
+				PCMSK0 |= (1 << RXPIN);
 
-void yacktune(void)
-/*! 
- @brief     Activates Tuning mode
- 
- This produces a solid keydown for TUNEDURATION seconds. After this the TX is unkeyed.
- The same can be achieved by presing either the DIT or the DAH contact or the control key.
- 
- */
-{
-	word timer = YACKSECS(TUNEDURATION);
+				if ((RXINP & (1 << RXPIN)) && (byte)(rxhead - rxtail) < RXSIZE)
+					rxbuf[rxhead++ & (RXSIZE - 1)] = data;
 
-	key(DOWN);
+				if ((byte)(rxhead - rxtail) >= RXHIGH)
+					SETBIT(CTSPORT, CTSPIN); // Ask the host to pause
+			}
+		}
+#endif
 
-	while (timer && (KEYINP & (1 << DITPIN)) && (KEYINP & (1 << DAHPIN))
-			&& !yackctrlkey(TRUE)) {
-		timer--;
-		yackbeat();
-	}
+#ifdef SERIALOUT
+		if (txbits && serahead(txnext) <= 1)
+		{
+			static byte data;	// Bits of the character left to send, LSB first
+
+			if (txbits == 1) // End of the stop bit
+			{
+				txbits = 0;
+				if (txhead != txtail) // Another character waiting?
+				{
+					data = txbuf[txtail & (TXSIZE - 1)];
+					txtail++;
+					txbits = 11;
+				}
+			}
+
+			if (txbits == 11) // Start bit
+				CLEARBIT(TXPORT, TXPIN);
+			else if (txbits > 2) // Data bit
+			{
+				if (data & 1)
+					SETBIT(TXPORT, TXPIN);
+				else
+					CLEARBIT(TXPORT, TXPIN);
+				data >>= 1;
+			} else if (txbits == 2) // Stop bit
+				SETBIT(TXPORT, TXPIN);
+
+			if (txbits)
+			{
+				txbits--;
+				txnext = sernext(txnext, SERBITCNT);
+			}
+		}
+#endif
+
+	} while (serschedule());
 
-	key(UP);
 }
 
-void yackmode(byte mode)
+#endif
+
+#ifdef SERIALIN
+
+char yackrx(void)
 /*! 
- @brief     Sets the keyer mode (e.g. IAMBIC A)
+ @brief     Fetches a character from the serial input
  
- This allows to set the content of the two mode bits in yackflags. Currently only
- two modes are supported, IAMBIC A and IAMBIC B.
+ Returns the oldest character in the receive buffer and lowers CTS again once the buffer
+ has drained to RXLOW characters. Line ends are returned as spaces.
  
- @param mode    IAMBICA or IAMBICB
- @return    TRUE is all was OK, FALSE if configuration lock prevented changes
+ @return    The character, 0 if the buffer is empty
  
  */
 {
 
-	yackflags &= ~MODE;
-	yackflags |= mode;
+	char c;
 
-	volflags |= DIRTYFLAG; // Set the dirty flag	
+	if (rxhead == rxtail) // Nothing received?
+		return 0;
+
+	c = rxbuf[rxtail++ & (RXSIZE - 1)];
+
+	cli(); // The ISR must not raise CTS between the test and clearing it
+	if ((byte)(rxhead - rxtail) <= RXLOW)
+		CLEARBIT(CTSPORT, CTSPIN);
+	sei();
+
+	if (c == '\r' || c == '\n')
+		c = ' ';
+
+	return c;
 
 }
 
-byte yackflag(byte flag)
+#endif
+
+#ifdef SERIALOUT
+
+void yacktx(char c)
 /*! 
- @brief     Query feature flags
+ @brief     Queues a character for the serial output
  
- @param flag A byte which indicate which flags are to be queried 
- @return     0 if the flag(s) were clear, >0 if flag(s) were set
+ The character is sent in the background by TIM1_COMPB_vect. It is dropped if the 
+ transmit buffer is full, so the caller never has to wait.
+ 
+ @param c   The character to send
  
  */
 {
-	return yackflags & flag;
+
+	if ((byte)(txhead - txtail) >= TXSIZE) // No room?
+		return;
+
+	txbuf[txhead & (TXSIZE - 1)] = c;
+
+	cli();
+	txhead++;
+	if (!txbits) // Output idle? Start it in two Timer1 counts
+	{
+		txbits = 1;
+		txnext = sernext(TCNT1, 2);
+		serschedule();
+	}
+	sei();
+
 }
 
-void yacktoggle(byte flag)
+#endif
+
+#ifdef POWERSAVE
+
+void yackalarm(word t)
 /*! 
- @brief     Toggle feature flags
+ @brief     Sets a wakeup time for the standby
  
- When passed one (or more) flags, this routine flips the according bit in yackflags and
- thereby enables or disables the corresponding feature.
+ Asks the next call of yackpower(TRUE) to return at seconds clock t at the latest, and
+ not to power down fully before then. The request only holds for that one call, so the 
+ caller repeats it every pass of its loop for as long as it waits. The beacon uses this 
+ to wait for its next transmission.
  
- @param flag    A byte where any bit to toggle is set e.g. SIDETONE 
- @return    TRUE if all was OK, FALSE if configuration lock prevented changes
+ @param t   Seconds clock (see yacktime) at which to wake up
  
  */
 {
 
-	yackflags ^= flag;      // Toggle the feature bit
-	volflags |= DIRTYFLAG;  // Set the dirty flag
+	alarmtime = t;
+	alarmset = TRUE;
 
 }
 
-void yackerror(void)
+void yackpower(byte n)
 /*! 
- @brief     Creates a series of 8 dits
+ @brief     Manages the power saving mode
  
- The error prosign (8 dits) can not be encoded in our coding table. A call to this
- function produces it..
+ This is called in yackbeat intervals with either a TRUE or FALSE as parameter. FALSE marks
+ the keyer busy and restarts the count of idle seconds. TRUE then lets the power states
+ step down as the idle time grows:
+ 
+ - Up to SBTIME seconds, the CPU only sleeps in idle mode between heartbeats (see yackbeat).
+ - From SBTIME seconds on, the keyer is in standby. The CPU is powered down, which also stops
+   the heartbeat, and the watchdog wakes it up every 1 to 8 seconds to advance the seconds 
+   clock. This function only returns once an alarm set with yackalarm is due.
+ - From PSTIME seconds on, unless an alarm is set, the watchdog is switched off as well and
+   only a level change on one of the input pins wakes the chip up again.
+ 
+ A level change on an input pin always returns right away and restarts the count of idle
+ seconds.
+ 
+ @param n   TRUE: OK to sleep, FALSE: Can not sleep now
  
  */
+
 {
-	byte i;
+	static word idlestart = 0;	// Seconds clock when the keyer was last busy
+	word idle;
+	word left;					// Seconds to the next reason to wake up
+	word now;
 
-	for (i = 0; i < 8; i++) {
-		yackplay(DIT);
-		yackdelay(DITLEN);
+	if (!n) // Busy?
+	{
+		idlestart = seconds;
+		alarmset = FALSE;
+		return;
 	}
-	yackdelay(DAHLEN);
 
-}
+	if ((word)(seconds - idlestart) >= SBTIME) {
 
-// ***************************************************************************
-// CW Playback related functions
-// ***************************************************************************
+#ifdef TINY85
+		GIFR |= (1 << PCIF); //Clear interrupt flag
+#elif defined TINY84
+		GIFR |= (1 << PCIF0); //Clear interrupt flag
+#endif
 
-static void key(byte mode)
+		cfgcommit(TRUE); // Settings must be in EEPROM before we sleep
+
+		secbeats = 0; // The watchdog counts the seconds from here on
+
+		while (1) {
+
+			idle = seconds - idlestart;
+
+			if (alarmset) {
+				left = alarmtime - seconds;
+				if ((int16_t)left <= 0) // Alarm due?
+					break;
+			} else if (idle < PSTIME)
+				left = PSTIME - idle;
+			else
+				left = 0; // Power down until a pin wakes us up
+
+			// The longest watchdog period that does not overshoot
+			wdtset(left >= 8 ? 8 : left >= 4 ? 4 : left >= 2 ? 2 : left);
+			now = seconds;
+
+			set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+			sleep_enable();
+			sleep_bod_disable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+
+			// Interrupts stay enabled after waking up as the heartbeat depends on them.
+
+			if (seconds == now) // Woken by a pin, not the watchdog?
+			{
+				idlestart = seconds; // So we do not go to sleep right after waking up..
+				break;
+			}
+		}
+
+		wdtset(0); // Back to heartbeats
+	}
+
+	alarmset = FALSE;
+
+}
+
+static void wdtset(byte secs)
 /*! 
- @brief     Keys the transmitter and produces a sidetone
+ @brief     Sets the watchdog wakeup period
  
- .. but only if the corresponding functions (TXKEY and SIDETONE) have been set in
- the feature register. This function also handles a request to invert the keyer line
- if necessary (TXINV bit).
+ The watchdog is only used in interrupt mode, as a wakeup timer, never to reset the chip.
+ Changing its settings needs a timed sequence.
  
  This is a private function.
-
- @param mode    UP or DOWN
+ 
+ @param secs    Period in seconds (1, 2, 4 or 8), 0 switches the watchdog off
  
  */
 {
 
-	if (mode == DOWN) {
-		if (volflags & SIDETONE) // Are we generating a Sidetone?
-		{
-			OCR0A = ctcvalue;		// Then switch on the Sidetone generator
-#ifdef TINY85
-			OCR0B = ctcvalue;
+	byte wdp;
 
-			// Activate CTC mode
-			TCCR0A |= (1 << COM0B0 | 1 << WGM01);
+	// Watchdog prescaler bits for 1, 2, 4 and 8 s
+	wdp = secs == 8 ? (1 << WDP3) | (1 << WDP0) : secs == 4 ? (1 << WDP3) :
+			secs == 2 ? (1 << WDP2) | (1 << WDP1) | (1 << WDP0) : (1 << WDP2) | (1 << WDP1);
+
+	cli();
+
+	wdtsecs = secs;
+
+#ifdef TINY85
+	WDTCR = (1 << WDCE) | (1 << WDE);
+	WDTCR = secs ? (1 << WDIE) | wdp : 0;
 #elif defined TINY84
-			// Activate CTC mode
-			TCCR0A |= (1 << COM0A0 | 1 << WGM01);
+	WDTCSR = (1 << WDCE) | (1 << WDE);
+	WDTCSR = secs ? (1 << WDIE) | wdp : 0;
 #endif
 
+	sei();
 
-			// Configure prescaler
-			TCCR0B = 1 << CS01;
-		}
+}
 
-		if (volflags & TXKEY) // Are we keying the TX?
-		{
-			if (yackflags & TXINV) // Do we need to invert keying?
-				CLEARBIT(OUTPORT, OUTPIN);
-			else
-				SETBIT(OUTPORT, OUTPIN);
-		}
+ISR( WDT_vect)
+/*! 
+ @brief     Watchdog interrupt
+ 
+ Wakes the keyer up in standby and advances the seconds clock by the watchdog period.
+ */
+{
+	seconds += wdtsecs;
+}
 
-	}
+#endif
 
-	if (mode == UP) {
+void yacksave(void)
+/*! 
+ @brief     Saves all permanent settings to EEPROM
+ 
+ To save EEPROM write cycles, writing only happens when the flag DIRTYFLAG is set.
+ After preparing the record the flag is cleared.
+ 
+ The settings are not written right away, as each EEPROM byte takes 3.4 ms to write.
+ The record is committed to the next slot of the ring by the heartbeat once the keyer
+ is idle, one byte per tick so that no tick is stalled. Only bytes that differ from 
+ what the slot held before are written. Called again before the commit is complete, 
+ the same slot is written again with the newer settings.
+ 
+ @callergraph
+ 
+ */
+{
 
-		if (volflags & SIDETONE) // Sidetone active?
-		{
-			TCCR0A = 0;
-			TCCR0B = 0;
-		}
+	if (volflags & DIRTYFLAG) // Dirty flag set?
+	{
 
-		if (volflags & TXKEY) // Are we keying the TX?
+		if (cfgpos == CFGSIZE) // Last record complete? Then use the next slot.
 		{
-			if (yackflags & TXINV) // Do we need to invert keying?
-				SETBIT(OUTPORT, OUTPIN);
-			else
-				CLEARBIT(OUTPORT, OUTPIN);
+			if (++cfgslot == CFGSLOTS)
+				cfgslot = 0;
+			cfgrec[CFGSEQ]++;
 		}
 
+		cfgfill(cfgrec);
+
+		cfgpos = 0; // Commit from the first byte
+
+		volflags &= ~DIRTYFLAG; // Clear the dirty flag
 	}
 
 }
 
-void yackfarns(void)
+static byte cfgcheck(const byte *rec)
 /*! 
- @brief     Produces an additional waiting delay for farnsworth mode.
+ @brief     Calculates the check value of a settings record
+ 
+ This is a private function.
+ 
+ @param rec     The record
+ @return        MAGPAT xor the sum of all bytes before CFGCHECK
  
  */
 {
 
-	word i = farnsworth;
+	byte i;
+	byte sum = 0;
 
-	while (i--) {
-		yackdelay(1);
-	}
+	for (i = 0; i < CFGCHECK; i++)
+		sum += rec[i];
+
+	return (sum ^ MAGPAT);
 
 }
 
-void yackdelay(byte n)
+static void cfgfill(byte *rec)
 /*! 
- @brief     Produces an active waiting delay for n dot counts
+ @brief     Fills a settings record with the current settings
  
- This is used during the playback functions where active waiting is needed
+ The sequence number is left as it is and covered by the check value.
+ 
+ This is a private function.
  
- @param n   number of dot durations to delay (dependent on current keying speed!
+ @param rec     The record
  
  */
 {
 
-	byte i = n;
-	byte x;
+	rec[CFGFLAGS] = yackflags;
+	rec[CFGCTC] = ctcvalue & 0xFF;
+	rec[CFGCTC + 1] = ctcvalue >> 8;
+	rec[CFGWPM] = wpmhold ? wpmhold : wpm; // The keyer speed, not one held for the time being
+	rec[CFGFARNS] = farnsworth;
+	rec[CFGOPTS] = yackopts;
+	rec[CFGWEIGHT] = weight;
+	rec[CFGCOMP] = comp;
+	rec[CFGCHECK] = cfgcheck(rec);
 
-	while (i--) {
-		x = wpmcnt;
-		while (x--)
-			yackbeat();
-	}
+}
+
+static void cfgapply(const byte *rec)
+/*! 
+ @brief     Makes the settings of a record the current settings
+ 
+ The element timing is not derived from the new speed, the caller has to call speedcalc.
+ 
+ This is a private function.
+ 
+ @param rec     A valid record
+ 
+ */
+{
+
+	ctcvalue = rec[CFGCTC] | (rec[CFGCTC + 1] << 8); // Retrieve last ctc setting
+	wpm = rec[CFGWPM]; // Retrieve last wpm setting
+	farnsworth = rec[CFGFARNS]; // Retrieve last farnsworth setting
+	yackflags = rec[CFGFLAGS]; // Retrieve last flags
+	yackopts = rec[CFGOPTS]; // and options
+	weight = rec[CFGWEIGHT]; // Retrieve weight and compensation
+	comp = rec[CFGCOMP];
+#ifndef FIXEDMODE
+	modeset();
+#endif
 
 }
 
-void yackplay(byte i)
+static byte cfgload(void)
 /*! 
- @brief     Key the TX / Sidetone for the duration of a dit or a dah
+ @brief     Loads the newest valid settings record into cfgrec
  
- @param i   DIT or DAH
+ Sequence numbers are compared as a signed difference, so they can wrap around.
+ 
+ This is a private function.
+ 
+ @return        TRUE if a valid record was found
  
  */
 {
 
-	key(DOWN);
+	byte i;
+	byte seq = 0;	// Sequence number of the newest record so far
+	byte found = FALSE;
 
-#ifdef POWERSAVE
+	for (i = 0; i < CFGSLOTS; i++) {
 
-	yackpower(FALSE); // Avoid powerdowns when keying
+		eeprom_read_block(cfgrec, cfgring[i], CFGSIZE);
 
-#endif
+		if (cfgrec[CFGCHECK] != cfgcheck(cfgrec))
+			continue; // Erased or torn record
 
-	switch (i) {
-	case DAH:
-		yackdelay(DAHLEN);
-		break;
+		if (found && (signed char) (cfgrec[CFGSEQ] - seq) <= 0)
+			continue; // Older than the one we have
 
-	case DIT:
-		yackdelay(DITLEN);
-		break;
+		found = TRUE;
+		seq = cfgrec[CFGSEQ];
+		cfgslot = i;
+	}
+
+	if (found)
+		eeprom_read_block(cfgrec, cfgring[cfgslot], CFGSIZE);
+
+	return (found);
+
+}
+
+static void cfgcommit(byte wait)
+/*! 
+ @brief     Writes the pending settings record into EEPROM
+ 
+ The check byte is written last, so a record interrupted by a power loss is invalid
+ and the previous one is loaded at the next power up.
+ 
+ This is a private function.
+ 
+ @param wait    FALSE: write at most one byte, and only if the EEPROM is ready and the
+                keyer is idle. TRUE: write all remaining bytes and wait until done.
+ 
+ */
+{
+
+	while (cfgpos < CFGSIZE) {
+
+		if (!wait && (!eeprom_is_ready() || keydown || yackbusy()))
+			return; // Try again at the next tick
+
+		eeprom_update_byte(&cfgring[cfgslot][cfgpos], cfgrec[cfgpos]);
+		cfgpos++;
+
+		if (!wait)
+			return;
 	}
 
-	key(UP);
+	if (wait)
+		eeprom_busy_wait();
+
+}
+
+void yackinhibit(byte mode)
+/*! 
+ @brief     Inhibits keying during command phases
+ 
+ This function is used to inhibit and re-enable TX keying (if configured) and enforce the internal 
+ sidetone oscillator to be active so that the user can communicate with the keyer.
+ 
+ @param mode   ON inhibits keying, OFF re-enables keying 
+ 
+ */
+{
+
+	if (mode) {
+		volflags &= ~(TXKEY | SIDETONE);
+		volflags |= SIDETONE;
+	}
+
+	else
+
+	{
+		volflags &= ~(TXKEY | SIDETONE);
+		volflags |= (yackflags & (TXKEY | SIDETONE));
+		key(UP);
+	}
+
+}
+
+word yackuser(byte func, byte nr, word content)
+/*! 
+ @brief     Saves user defined settings
+ 
+ The routine using this library is given the opportunity to save up to two 16 bit sized
+ values in EEPROM. In case of the sample main function this is used to store the beacon interval 
+ timer value. With MSGMACROS, the library keeps the contest serial number in storage 2,
+ otherwise the routine is not used by the library.
+ 
+ @param func    States if the data is retrieved (READ) or written (WRITE) to EEPROM
+ @param nr      1 or 2 (Number of user storage to access)
+ @param content The 16 bit word to write. Not used in read mode.
+ @return        The content of the retrieved value in read mode.
+ 
+ */
+{
+
+	if (func == READ) {
+		if (nr == 1)
+			return (eeprom_read_word(&user1));
+		else if (nr == 2)
+			return (eeprom_read_word(&user2));
+	}
+
+	if (func == WRITE) {
+
+		if (nr == 1)
+			eeprom_update_word(&user1, content);
+		else if (nr == 2)
+			eeprom_update_word(&user2, content);
+	}
+
+	return (FALSE);
+
+}
+
+#ifdef PROFILES
+
+byte yackprofile(byte func, byte nr)
+/*! 
+ @brief     Stores or recalls a setting profile
+ 
+ WRITE stores the current settings into profile nr. READ reads the profile with a single
+ EEPROM block read and switches all settings over with interrupts disabled, so the heartbeat
+ never sees the pitch and speed of two different profiles. Neither yackreset nor a wait for
+ the EEPROM is needed. The new settings are taken into the journal by the next yacksave
+ like any other change.
+ 
+ @param func    READ (recall) or WRITE (store)
+ @param nr      1 to PROFILES
+ @return        TRUE if done, FALSE if nr is out of range or the profile was never stored
+ 
+ */
+{
+
+	byte rec[CFGSIZE];
+
+	if (nr < 1 || nr > PROFILES)
+		return (FALSE);
+
+	if (func == READ) {
+
+		eeprom_read_block(rec, profiles[nr - 1], CFGSIZE);
+
+		if (rec[CFGCHECK] != cfgcheck(rec))
+			return (FALSE); // Empty or torn
+
+		cli();
+		cfgapply(rec);
+		speedcalc();
+		sei();
+
+		volflags |= DIRTYFLAG;
+	}
+
+	if (func == WRITE) {
+
+		rec[CFGSEQ] = nr;
+		cfgfill(rec);
+		eeprom_update_block(rec, profiles[nr - 1], CFGSIZE);
+	}
+
+	return (TRUE);
+
+}
+
+#endif
+
+word yackwpm(void)
+/*! 
+ @brief     Retrieves the current WPM speed
+ 
+ This function delivers the current WPM speed. 
+
+ @return        Current speed in WPM
+ 
+ */
+{
+
+	return wpm;
+
+}
+
+#ifdef WEIGHTING
+
+byte yackweight(byte mode)
+/*! 
+ @brief     Retrieves the keying weight or the compensation
+ 
+ @param mode    WEIGHT or COMPENSATION
+ @return        Weight in % or compensation in ms
+ 
+ */
+{
+
+	return (mode == WEIGHT) ? weight : comp;
+
+}
+
+#endif
+
+word yacktime(void)
+/*! 
+ @brief     Retrieves the seconds clock
+ 
+ Counts the seconds since power up, in heartbeats while the keyer is awake and in
+ watchdog wakeups during standby. The watchdog runs from its own oscillator, which
+ is only accurate to about 10%. The clock stops in full power down.
+ 
+ The count wraps around after about 18 hours, so only use differences.
+ 
+ @return        Seconds since power up
+ 
+ */
+{
+
+	return seconds;
+
+}
+
+byte yackrandom(byte n)
+/*! 
+ @brief     Random number generator
+ 
+ A 16 bit xorshift generator (shifts 7, 9 and 8) with a period of 65535. The upper byte
+ is scaled to the range by a multiplication instead of a modulo, so the time taken does
+ not depend on n. Without RANDOMSEED, the sequence is the same after every power up.
+ 
+ @param n   The number of possible results, 0 just advances the generator
+ @return    A random number between 0 and n-1
+ 
+ */
+{
+
+	word x = rndstate;
+
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	rndstate = x;
+
+	return ((x >> 8) * n) >> 8;
+
+}
+
+#ifdef RANDOMSEED
+
+#ifdef TINY85
+#define		WDTREG			WDTCR
+#elif defined TINY84
+#define		WDTREG			WDTCSR
+#endif
+
+static void rndseed(void)
+/*! 
+ @brief     Seeds the random generator at power up
+ 
+ The watchdog runs from its own 128 kHz oscillator, which drifts and jitters against
+ the system clock. For RNDSEEDS watchdog periods of 16 ms, the number of polling loops
+ until the period ended and the Timer1 count are mixed into the generator. The watchdog 
+ is only used in interrupt mode, but with interrupts disabled its flag is just polled.
+ 
+ Must be called with interrupts disabled.
+ 
+ This is a private function.
+ 
+ */
+{
+
+	byte i;
+	word n;
+
+	for (i = 0; i < RNDSEEDS; i++) {
+		WDTREG = (1 << WDCE) | (1 << WDE);
+		WDTREG = (1 << WDIF) | (1 << WDIE); // Shortest period, a one clears the flag
+
+		n = 0;
+		while (!(WDTREG & (1 << WDIF))) // Wait for the end of the period
+			n++;
+
+		rndstate ^= n ^ (TCNT1 << 8);
+		if (!rndstate) // The one state xorshift never leaves
+			rndstate = 0xACE1;
+		yackrandom(0);
+	}
+
+	WDTREG = (1 << WDCE) | (1 << WDE);
+	WDTREG = (1 << WDIF); // Off again
+
+}
+
+#endif
+
+void yackspeed(byte dir, byte mode)
+/*! 
+ @brief     Increases or decreases the current WPM speed
+ 
+ The amount of increase or decrease is in amounts of wpmcnt. Those are close to real
+ WPM in a 10ms heartbeat but can significantly differ at higher heartbeat speeds.
+ With FARNSWORTH, WEIGHT or COMPENSATION, that setting is stepped instead, by one
+ (Farnsworth) pause unit, one percent or one millisecond.
+ 
+ @param dir     UP (faster, lighter) or DOWN (slower, heavier)
+ @param mode    WPMSPEED, FARNSWORTH, WEIGHT or COMPENSATION
+ 
+ */
+{
+
+	if (mode == FARNSWORTH) {
+		if ((dir == UP) && (farnsworth > 0))
+			farnsworth--;
+
+		if ((dir == DOWN) && (farnsworth < MAXFARN))
+			farnsworth++;
+	}
+#ifdef WEIGHTING
+	else if (mode == WEIGHT) {
+		if ((dir == UP) && (weight > MINWEIGHT))
+			weight--;
+
+		if ((dir == DOWN) && (weight < MAXWEIGHT))
+			weight++;
+
+		speedcalc();
+	} else if (mode == COMPENSATION) {
+		if ((dir == UP) && (comp > 0))
+			comp--;
+
+		if ((dir == DOWN) && (comp < MAXCOMP))
+			comp++;
+
+		speedcalc();
+	}
+#endif
+	else // WPMSPEED
+	{
+		if ((dir == UP) && (wpm < MAXWPM))
+			wpm++;
+
+		if ((dir == DOWN) && (wpm > MINWPM))
+			wpm--;
+
+		speedcalc(); // Calculate beats
+
+	}
+
+	if (mode != WPMSPEED || !wpmhold) // A speed held aside is not saved
+		volflags |= DIRTYFLAG; // Set the dirty flag
+
+	yackplay(DIT);
+	yackdelay(IEGLEN);	// Inter Element gap
+	yackplay(DAH);
+	yackdelay(ICGLEN);	// Inter Character gap
+	yackfarns(); // Additional Farnsworth delay
+	yackwait(); // Confirm one step at a time
+
+}
+
+void yackwpmset(word n)
+/*! 
+ @brief     Sets the speed for the time being
+ 
+ Unlike yackspeed, this does not set the dirty flag, so the speed is not saved as the 
+ keyer speed. The caller sets the speed back before anything else has to be saved, 
+ as yacksave would then take the speed along, unless the keyer speed is held aside with
+ yackwpmhold. Speeds out of MINWPM..MAXWPM are ignored.
+ 
+ @param n       Speed in WPM
+ 
+ */
+{
+
+	if (n < MINWPM || n > MAXWPM)
+		return;
+
+	wpm = n;
+	speedcalc();
+
+}
+
+void yackwpmhold(byte mode)
+/*! 
+ @brief     Sets the keyer speed aside while another one is in use
+ 
+ With ON, the current speed is kept as the keyer speed. Until the call with OFF, the 
+ speed can be changed with yackwpmset or yackspeed without being saved: yacksave stores
+ the speed set aside instead. OFF goes back to that speed.
+ 
+ @param mode    ON or OFF
+ 
+ */
+{
+
+	if (mode == ON) {
+		if (!wpmhold)
+			wpmhold = wpm;
+	} else if (wpmhold) {
+		yackwpmset(wpmhold);
+		wpmhold = 0;
+	}
+
+}
+
+word yackdiv(uint32_t n, word d)
+/*! 
+ @brief     Divides a number by a word
+ 
+ A shift and subtract division, so that the keyer does without the divide routines 
+ of the C library. Like numsend, it only takes subtractions, one per quotient bit,
+ so small quotients are quick whatever the size of the dividend.
+ 
+ @param n       Dividend, less than 65536 times the divisor
+ @param d       Divisor
+ @return        n / d rounded down, 0 for a divisor of 0
+ 
+ */
+{
+
+	uint32_t s = d;	// Divisor shifted to the quotient bit
+	word q = 0;		// Quotient
+	word bit = 1;	// Quotient bit of the divisor as shifted
+
+	if (!d)
+		return 0;
+
+	while (s < n && !(bit & 0x8000)) { // Line the divisor up with the dividend
+		s <<= 1;
+		bit <<= 1;
+	}
+
+	while (bit) {
+		if (n >= s) {
+			n -= s;
+			q |= bit;
+		}
+		s >>= 1;
+		bit >>= 1;
+	}
+
+	return q;
+
+}
+
+static void speedcalc(void)
+/*! 
+ @brief     Derives the element timing from the current WPM speed
+ 
+ Sets wpmcnt, the number of heartbeats in a dot. Without FINETIMING, the dot length 
+ is simply rounded down to whole beats of YACKBEAT ms, which gets coarse at high speeds.
+ 
+ With FINETIMING, the dot is first calculated in Timer1 counts. It is then split into 
+ the number of beats closest to YACKBEAT ms each, and the Timer1 period is trimmed so 
+ that these beats add up to the dot length. All elements and gaps are whole dots, so 
+ they are accurate to better than 1% across MINWPM..MAXWPM.
+ 
+ This is a private function.
+ 
+ */
+{
+
+#ifdef FINETIMING
+
+	word dot;	// Timer1 counts in a dot
+	byte top;	// Timer1 counts in a beat
+
+	dot = yackdiv(DOTCNT(1), wpm);
+	wpmcnt = yackdiv(dot + BEATCNT / 2, BEATCNT); // Closest number of beats
+	top = yackdiv(dot + wpmcnt / 2, wpmcnt); // Beat length that fits best
+
+#ifdef TINY85
+	OCR1C = top - 1; // Counts 0..OCR1C
+	if (TCNT1 >= top)
+		TCNT1 = 0; // Don't let the counter run past the new top
+#elif defined TINY84
+	OCR1A = top - 1;
+	if (TCNT1 >= top)
+		TCNT1 = 0;
+#endif
+
+#else
+
+	wpmcnt = yackdiv(WPMCALC(1), wpm);
+
+#endif
+
+#ifdef WEIGHTING
+	{
+		int16_t d;	// Timer1 counts in a dot
+		int16_t x;	// Lengthening of the marks
+
+#ifdef TINY85
+		d = (OCR1C + 1) * wpmcnt;
+#elif defined TINY84
+		d = (OCR1A + 1) * wpmcnt;
+#endif
+
+		// Divided by 100-DEFWEIGHT as a multiplication by WTRECIP/65536, rounded to a count
+		x = (((int32_t)d * (weight - DEFWEIGHT) * WTRECIP + 0x8000) >> 16) + (int16_t)COMPCNT(comp);
+
+		// Leave at least a quarter of a dot for the shortest mark or gap
+		if (x > d - d / 4)
+			x = d - d / 4;
+		if (x < d / 4 - d)
+			x = d / 4 - d;
+
+		wtcnt = x;
+	}
+#endif
+
+}
+
+#ifdef CLOCKPROFILE
+
+static void clockset(byte fast)
+/*! 
+ @brief     Switches the CPU clock between F_CPU and CLKFACTOR * F_CPU
+ 
+ The system clock prescaler and the timer prescalers are changed together with interrupts
+ disabled, so that Timer1 keeps counting BEATCLK and the CTC sidetone keeps its pitch. The
+ shaped sidetone gets CLKFACTOR times the samples, so its phase step and ramp are scaled.
+ 
+ This is a private function.
+ 
+ @param fast    TRUE for the fast clock, FALSE for F_CPU
+ 
+ */
+{
+
+	byte div = fast ? CLKFASTDIV : CLKSLOWDIV;
+#ifdef SHAPEDTONE
+	word step;
+#endif
+
+	if (fast == clockfast)
+		return;
+
+#ifdef SHAPEDTONE
+	step = TONESTEP(stepctc);
+	if (fast)
+		step /= CLKFACTOR;
+#endif
+
+	cli();
+
+	CLKPR = 1 << CLKPCE; // Timed sequence, the new setting must follow within 4 cycles
+	CLKPR = div;
+
+#ifdef TINY85
+	TCCR1 = (TCCR1 & 0xF0) | (fast ? 0b00001010 : 0b00000111); // Prescaler 512 or 64
+#elif defined TINY84
+	TCCR1B = (TCCR1B & 0xF8) | (fast ? 0b00000100 : 0b00000011); // Prescaler 256 or 64
+#endif
+
+#ifdef SHAPEDTONE
+	tonestep = step;
+	rampcnt = fast ? RAMPCNT * CLKFACTOR : RAMPCNT;
+#else
+	if (TCCR0B) // CTC sidetone running?
+		TCCR0B = fast ? (1 << CS01 | 1 << CS00) : (1 << CS01); // Prescaler 64 or 8
+#endif
+
+	clockfast = fast;
+
+	sei();
+
+}
+
+static void clockprofile(void)
+/*! 
+ @brief     Selects the clock profile for the next heartbeat
+ 
+ Called from yackbeat. The clock goes up as soon as an element is keyed or queued, and
+ drops back to F_CPU once nothing was keyed for CLKIDLE seconds, so that it does not
+ toggle between the elements and characters of a transmission.
+ 
+ This is a private function.
+ 
+ */
+{
+
+	if (keydown || yackbusy()) {
+		clockhold = YACKSECS(CLKIDLE);
+		clockset(TRUE);
+	} else if (clockhold && !--clockhold)
+		clockset(FALSE);
+
+}
+
+#endif
+
+void yackbeat(void)
+/*! 
+ @brief     Heartbeat delay
+ 
+ Several functions in the keyer are timing dependent. The most prominent example is the
+ yackiambic function that implements the IAMBIC keyer finite state machine.
+ The same expects to be called in intervals of YACKBEAT milliseconds. This routine
+ puts the CPU into idle sleep until the Timer1 heartbeat interrupt signals the next
+ tick, so no current is wasted busy waiting between ticks. Timer0 keeps running in
+ idle mode so the sidetone is not affected.
+ 
+ */
+{
+	cli();
+
+#ifdef LATSTATS
+	if (beats && overruns < 0xFFFF) // Did the last tick's work run into this one?
+		overruns++;
+#endif
+
+	while (!beats) // No tick since the last call?
+	{
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_enable();
+		sei(); // The instruction following SEI is executed before any interrupt
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+
+	beats = 0; // Consume the tick. Like the old busy wait, missed ticks are not caught up.
+
+	sei();
+
+	if (++secbeats >= YACKSECS(1)) // Another second of heartbeats?
+	{
+		secbeats = 0;
+		seconds++;
+	}
+
+#ifdef WEIGHTING
+	cli();
+	if (wtedge) { // Held back edge of the key line one heartbeat closer
+#ifdef TINY85
+		wtleft -= OCR1C + 1;
+#elif defined TINY84
+		wtleft -= OCR1A + 1;
+#endif
+		wtarm();
+	}
+	sei();
+#endif
+
+#ifdef PTT
+	ptttick(); // Delayed TX key line and PTT
+#endif
+
+	playtick(); // Advance the playback engine
+
+#ifdef CLOCKPROFILE
+	clockprofile(); // Speed up for keying, slow down when idle
+#endif
+
+	cfgcommit(FALSE); // Write pending settings while idle
+}
+
+void yackpitch(byte dir)
+/*! 
+ @brief     Increases or decreases the sidetone pitch
+ 
+ Changes are done not in Hz but in ctc control values. This is to avoid extensive 
+ calculations at runtime. As is all calculations are done by the preprocessor.
+ 
+ @param dir     UP or DOWN
+ 
+ */
+{
+	if (dir == UP)
+		ctcvalue--;
+	if (dir == DOWN)
+		ctcvalue++;
+
+	if (ctcvalue < MAXCTC)
+		ctcvalue = MAXCTC;
+
+	if (ctcvalue > MINCTC)
+		ctcvalue = MINCTC;
+
+	volflags |= DIRTYFLAG; // Set the dirty flag
+
+}
+
+void yacktune(void)
+/*! 
+ @brief     Activates Tuning mode
+ 
+ This produces a solid keydown for TUNEDURATION seconds. After this the TX is unkeyed.
+ The same can be achieved by presing either the DIT or the DAH contact or the control key.
+ 
+ */
+{
+	word timer = YACKSECS(TUNEDURATION);
+
+	key(DOWN);
+
+	while (timer && (KEYINP & (1 << DITPIN)) && (KEYINP & (1 << DAHPIN))
+			&& !yackctrlkey(TRUE)) {
+		timer--;
+		yackbeat();
+	}
+
+	key(UP);
+}
+
+#ifndef FIXEDMODE
+
+void yackmode(byte mode)
+/*! 
+ @brief     Sets the keyer mode (e.g. IAMBIC A)
+ 
+ This allows to set the content of the two mode bits in yackflags and selects the 
+ paddle latching of that mode for yackiambic.
+ 
+ @param mode    IAMBICA, IAMBICB, ULTIMATIC or DAHPRIO
+ 
+ */
+{
+
+	yackflags &= ~MODE;
+	yackflags |= mode;
+	modeset();
+
+	volflags |= DIRTYFLAG; // Set the dirty flag	
+
+}
+
+#endif
+
+byte yackflag(byte flag)
+/*! 
+ @brief     Query feature flags
+ 
+ @param flag A byte which indicate which flags are to be queried 
+ @return     0 if the flag(s) were clear, >0 if flag(s) were set
+ 
+ */
+{
+	return yackflags & flag;
+}
+
+void yacktoggle(byte flag)
+/*! 
+ @brief     Toggle feature flags
+ 
+ When passed one (or more) flags, this routine flips the according bit in yackflags and
+ thereby enables or disables the corresponding feature.
+ 
+ @param flag    A byte where any bit to toggle is set e.g. SIDETONE 
+ @return    TRUE if all was OK, FALSE if configuration lock prevented changes
+ 
+ */
+{
+
+	yackflags ^= flag;      // Toggle the feature bit
+	volflags |= DIRTYFLAG;  // Set the dirty flag
+
+}
+
+byte yackoptflag(byte opt)
+/*! 
+ @brief     Query options
+ 
+ The options are stored in their own byte of the settings record, as yackflags is full.
+ 
+ @param opt  A byte which indicates which options are to be queried, e.g. CUTNUMS
+ @return     0 if the option(s) were clear, >0 if option(s) were set
+ 
+ */
+{
+	return yackopts & opt;
+}
+
+void yackoption(byte opt)
+/*! 
+ @brief     Toggle options
+ 
+ @param opt    A byte where any option to toggle is set e.g. CUTNUMS
+ 
+ */
+{
+
+	yackopts ^= opt;        // Toggle the option bit
+	volflags |= DIRTYFLAG;  // Set the dirty flag
+
+}
+
+void yackerror(void)
+/*! 
+ @brief     Creates a series of 8 dits
+ 
+ The error prosign (8 dits) can not be encoded in our coding table. A call to this
+ function produces it..
+ 
+ */
+{
+	byte i;
+
+	for (i = 0; i < 8; i++) {
+		yackplay(DIT);
+		yackdelay(DITLEN);
+	}
+	yackdelay(DAHLEN);
+	yackwait();
+
+}
+
+// ***************************************************************************
+// CW Playback related functions
+// ***************************************************************************
+
+static void key(byte mode)
+/*! 
+ @brief     Keys the transmitter and produces a sidetone
+ 
+ .. but only if the corresponding functions (TXKEY and SIDETONE) have been set in
+ the feature register. This function also handles a request to invert the keyer line
+ if necessary (TXINV bit).
+ 
+ With SHAPEDTONE, the sidetone is only started here. The Timer0 interrupt ramps it up
+ and, after key(UP), back down.
+ 
+ This is a private function.
+
+ @param mode    UP or DOWN
+ 
+ */
+{
+
+	keydown = (mode == DOWN);
+
+	if (mode == DOWN) {
+		if (volflags & SIDETONE) // Are we generating a Sidetone?
+		{
+#ifdef SHAPEDTONE
+			if (ctcvalue != stepctc) // Pitch changed since the last element?
+			{
+				word step = TONESTEP(ctcvalue);
+
+#ifdef CLOCKPROFILE
+				if (clockfast)
+					step /= CLKFACTOR; // More samples per second
+#endif
+
+				stepctc = ctcvalue;
+				cli();
+				tonestep = step;
+				sei();
+			}
+
+			toneup = TRUE; // From here on the interrupt will not stop the timer
+
+			if (!TCCR0B) // Tone not still fading out from the last element?
+			{
+#ifdef TINY85
+				// Fast PWM on OC0B
+				TCCR0A = (1 << COM0B1 | 1 << WGM01 | 1 << WGM00);
+#elif defined TINY84
+				// Fast PWM on OC0A
+				TCCR0A = (1 << COM0A1 | 1 << WGM01 | 1 << WGM00);
+#endif
+
+				// No prescaler, one sample every 256 cycles
+				TCCR0B = 1 << CS00;
+			}
+#else
+			OCR0A = ctcvalue;		// Then switch on the Sidetone generator
+#ifdef TINY85
+			OCR0B = ctcvalue;
+
+			// Activate CTC mode
+			TCCR0A |= (1 << COM0B0 | 1 << WGM01);
+#elif defined TINY84
+			// Activate CTC mode
+			TCCR0A |= (1 << COM0A0 | 1 << WGM01);
+#endif
+
+
+			// Configure prescaler
+#ifdef CLOCKPROFILE
+			if (clockfast)
+				TCCR0B = 1 << CS01 | 1 << CS00; // 64 at 8 MHz is the same as 8 at 1 MHz
+			else
+#endif
+			TCCR0B = 1 << CS01;
+#endif
+		}
+
+		if (volflags & TXKEY) // Are we keying the TX?
+		{
+#ifdef PTT
+			SETBIT(PTTPORT, PTTPIN); // PTT right away, the key line follows in ptttick
+			txwant = TRUE;
+#else
+			txkey(DOWN);
+#endif
+		}
+
+#ifdef LATSTATS
+		if (latpending) // Is a paddle closure waiting for this?
+		{
+			word lat;
+
+			cli();
+			lat = timestamp() - latstart;
+			sei();
+
+			latpending = FALSE;
+
+			if (lat > latmax)
+				latmax = lat;
+
+			if (latcount == 0xFFFF || latsum > 0xFFFF - lat) // Keep the average from overflowing
+			{
+				latsum >>= 1;
+				latcount >>= 1;
+			}
+
+			latsum += lat;
+			latcount++;
+		}
+#endif
+
+	}
+
+	if (mode == UP) {
+
+		if (volflags & SIDETONE) // Sidetone active?
+		{
+#ifdef SHAPEDTONE
+			toneup = FALSE; // The interrupt fades the tone out and stops the timer
+#else
+			TCCR0A = 0;
+			TCCR0B = 0;
+#endif
+		}
+
+#ifdef PTT
+		txwant = FALSE; // Also when TX keying was inhibited in the meantime
+#else
+		if (volflags & TXKEY) // Are we keying the TX?
+			txkey(UP);
+#endif
+
+	}
+
+}
+
+static void txline(byte mode)
+/*! 
+ @brief     Sets the TX key line
+ 
+ Handles the TXINV bit. This is a private function.
+ 
+ @param mode    UP or DOWN
+ 
+ */
+{
+
+	if ((mode == DOWN) != !!(yackflags & TXINV)) // Active level high?
+		SETBIT(OUTPORT, OUTPIN);
+	else
+		CLEARBIT(OUTPORT, OUTPIN);
+
+}
+
+static void txkey(byte mode)
+/*! 
+ @brief     Keys the TX key line with weighting
+ 
+ With WEIGHTING, the edge that lengthens the mark, or with a negative wtcnt the one that
+ shortens it, is held back by wtcnt Timer1 counts. The other edge is set right away.
+ 
+ This is a private function.
+ 
+ @param mode    UP or DOWN
+ 
+ */
+{
+
+#ifdef WEIGHTING
+
+	byte sreg = SREG; // yackinit keys the line before interrupts are enabled
+
+	cli();
+
+	if (wtedge) // Still one held back? Does not happen unless a mark is shorter than wtcnt.
+		wtfire();
+
+	if (wtcnt && ((mode == UP) == (wtcnt > 0))) // The edge to hold back?
+	{
+		wtedge = mode;
+		wtleft = beatpos() + (wtcnt > 0 ? wtcnt : -wtcnt);
+		wtarm();
+	} else
+		txline(mode);
+
+	SREG = sreg;
+
+#else
+
+	txline(mode);
+
+#endif
+
+}
+
+#ifdef WEIGHTING
+
+static byte beatpos(void)
+/*! 
+ @brief     Timer1 counts since the last heartbeat tick
+ 
+ This is a private function.
+ 
+ */
+{
+
+	byte cnt = TCNT1;
+
+#ifdef TINY85
+	return cnt ? cnt - 1 : OCR1C; // The tick is raised when TCNT1 reaches OCR1A = 1
+#elif defined TINY84
+	return (cnt == OCR1A) ? 0 : cnt + 1; // The tick is raised at the top in OCR1A
+#endif
+
+}
+
+static void wtarm(void)
+/*! 
+ @brief     Times the held back edge of the key line
+ 
+ Called with interrupts disabled when the edge is held back and at every heartbeat tick 
+ after. Once the edge falls into the current heartbeat, compare match B is set to it, or
+ the edge is set right away if it is too close. With WTROUND, the edge is set at the tick
+ closest to it.
+ 
+ This is a private function.
+ 
+ */
+{
+
+#ifdef TINY85
+	byte top = OCR1C + 1;
+#elif defined TINY84
+	byte top = OCR1A + 1;
+#endif
+
+#ifdef WTROUND
+
+	if (wtleft < top / 2)
+		wtfire();
+
+#else
+
+	if (wtleft >= top) // Not in this heartbeat
+		return;
+
+	if (wtleft <= beatpos() + 1) // Too close to be sure the match is not missed
+	{
+		wtfire();
+		return;
+	}
+
+#ifdef TINY85
+	OCR1B = (wtleft + 1 == top) ? 0 : wtleft + 1; // TCNT1 wraps to 0 after OCR1C
+	TIFR = (1 << OCF1B); // Clear a stale match
+	TIMSK |= (1 << OCIE1B);
+#elif defined TINY84
+	OCR1B = wtleft - 1;
+	TIFR1 = (1 << OCF1B);
+	TIMSK1 |= (1 << OCIE1B);
+#endif
+
+#endif
+
+}
+
+static void wtfire(void)
+/*! 
+ @brief     Sets the held back edge of the key line
+ 
+ Must be called with interrupts disabled. This is a private function.
+ 
+ */
+{
+
+	txline(wtedge);
+	wtedge = 0;
+
+#ifndef WTROUND
+#ifdef TINY85
+	TIMSK &= ~(1 << OCIE1B);
+#elif defined TINY84
+	TIMSK1 &= ~(1 << OCIE1B);
+#endif
+#endif
+
+}
+
+#ifndef WTROUND
+
+ISR( TIM1_COMPB_vect)
+/*! 
+ @brief     Weighting interrupt
+ 
+ Sets the held back edge of the key line at the Timer1 count it is due.
+ */
+{
+	wtfire();
+}
+
+#endif
+
+#endif
+
+#ifdef PTT
+
+static void ptttick(void)
+/*! 
+ @brief     Advances the PTT sequencer by one heartbeat
+ 
+ Called from yackbeat. The key line is set to what key() asked for PTTBEATS heartbeats
+ ago, so every mark and gap keeps its length on air. PTT is dropped once the key line has
+ been up for PTTHANGBEATS heartbeats.
+ 
+ This is a private function.
+ 
+ */
+{
+
+	word keyed; // Key line before this heartbeat
+
+#ifdef WEIGHTING
+	if (txhist || txwant || wtedge) // Keyed, about to be, or an edge still held back?
+#else
+	if (txhist || txwant) // Keyed or about to be?
+#endif
+		txhang = PTTHANGBEATS;
+	else if (!txhang || !--txhang) // Hang time over?
+		CLEARBIT(PTTPORT, PTTPIN);
+
+	keyed = txhist & PTTOUT;
+	txhist = ((txhist << 1) | txwant) & PTTMASK;
+
+	if (!keyed != !(txhist & PTTOUT)) // Key line changes?
+		txkey(keyed ? UP : DOWN);
+
+}
+
+#endif
+
+static void playqueue(byte element)
+/*! 
+ @brief     Appends an element to the playback queue
+ 
+ If the queue is full, this waits for the heartbeat to make room. Once the paddles
+ have broken off playback (see playbreak), the element is dropped.
+ 
+ This is a private function.
+
+ @param element   Number of dot lengths, PQMARK added if the key is to be down
+ 
+ */
+{
+
+	while ((byte)(pqtail - pqhead) >= PQSIZE) { // Queue full?
+		if (playbreak())
+			return;
+		yackbeat();
+	}
+
+	if (volflags & PDLBREAK)
+		return;
+
+	playq[pqtail++ & (PQSIZE - 1)] = element;
+
+}
+
+static void playtick(void)
+/*! 
+ @brief     Plays the queued elements, one heartbeat at a time
+ 
+ Called from yackbeat. Once the current element has run for its number of beats
+ the key is released and the next element is started.
+ 
+ This is a private function.
+ 
+ */
+{
+	byte element;
+
+	if (pqtimer && --pqtimer) // Current element still running?
+		return;
+
+	if (pqkeyed) // End of a mark
+	{
+		key(UP);
+		pqkeyed = FALSE;
+	}
+
+	if (pqhead != pqtail) // Anything left to play?
+	{
+		element = playq[pqhead++ & (PQSIZE - 1)];
+
+		if (element & PQMARK) {
+			key(DOWN);
+			pqkeyed = TRUE;
+
+#ifdef POWERSAVE
+
+			yackpower(FALSE); // Avoid powerdowns when keying
+
+#endif
+		}
+
+		pqtimer = (element & PQDOTS) * wpmcnt;
+	}
+
+}
+
+static void playstop(void)
+/*! 
+ @brief     Aborts playback immediately
+ 
+ Drops all queued elements and releases the key if playback was holding it down.
+ 
+ This is a private function.
+ 
+ */
+{
+
+	pqhead = pqtail;
+	pqtimer = 0;
+
+	if (pqkeyed) {
+		key(UP);
+		pqkeyed = FALSE;
+	}
+
+#ifdef PTT
+	txhist = 0; // Nothing more goes on air
+	txline(UP);
+#endif
+
+#ifdef WEIGHTING
+	cli();
+	if (wtedge) { // Drop a held back edge as well
+		wtedge = UP;
+		wtfire();
+	}
+	sei();
+#endif
+
+}
+
+static byte playbreak(void)
+/*! 
+ @brief     Breaks off playback when a paddle is closed
+ 
+ Samples the paddles once. On a closure, playback is stopped and PDLBREAK is set, so that
+ nothing more is queued until yackiambic takes over. With the IAMBIC keyer, the closure 
+ is latched for it with keylatch, a straight key sees the contact still closed. Inside
+ yackctrlkey, the paddles change the speed and are left alone.
+ 
+ This is a private function.
+
+ @return        TRUE if playback has been broken off by the paddles
+ 
+ */
+{
+
+	if (volflags & PDLBREAK)
+		return TRUE;
+
+	if (volflags & CKBUSY)
+		return FALSE;
+
+#ifdef STRAIGHTKEY
+	if (yackflags & STRAIGHT) {
+		if (!(~KEYINP & PDLMASK))
+			return FALSE;
+	} else
+#endif
+	{
+		keylatch();
+		if (!(volflags & SQUEEZED))
+			return FALSE;
+	}
+
+	playstop();
+	volflags |= PDLBREAK;
+
+	return TRUE;
+
+}
+
+static byte playwait(byte room)
+/*! 
+ @brief     Runs the heartbeat until the playback queue has room
+ 
+ Unless we are inside yackctrlkey (speed change confirmation), a press of the command 
+ key aborts playback. The key press stays latched for the caller to see. A paddle 
+ closure breaks off playback as well, see playbreak.
+ 
+ This is a private function.
+
+ @param room    Number of free queue slots required. PQSIZE waits until playback is complete.
+ @return        TRUE if playback was aborted by the command key or the paddles
+ 
+ */
+{
+
+	while (1) {
+
+		if (!(volflags & CKBUSY) && yackctrlkey(FALSE))
+			return TRUE;
+
+		if (playbreak())
+			return TRUE;
+
+		if (room == PQSIZE ? !yackbusy() : (byte)(pqtail - pqhead) <= PQSIZE - room)
+			return FALSE;
+
+		yackbeat();
+	}
+
+}
+
+byte yackbusy(void)
+/*! 
+ @brief     Queries the playback engine
+ 
+ @return    TRUE while elements are queued or still being played
+ 
+ */
+{
+
+	return (pqtimer || pqhead != pqtail);
+
+}
+
+byte yackwait(void)
+/*! 
+ @brief     Waits for all queued elements to be played
+ 
+ The heartbeat keeps running while waiting. A press of the command key aborts
+ playback (see playwait).
+ 
+ @return    TRUE if playback was aborted by the command key
+ 
+ */
+{
+
+	return playwait(PQSIZE);
+
+}
+
+void yackfarns(void)
+/*! 
+ @brief     Queues an additional waiting delay for farnsworth mode.
+ 
+ */
+{
+
+	byte i = farnsworth;
+
+	while (i > PQDOTS) {
+		playqueue(PQDOTS);
+		i -= PQDOTS;
+	}
+
+	if (i)
+		playqueue(i);
+
+}
+
+void yackdelay(byte n)
+/*! 
+ @brief     Queues a gap of n dot counts
+ 
+ This is used during the playback functions. The gap is played by the heartbeat.
+ 
+ @param n   number of dot durations to delay (dependent on current keying speed!)
+ 
+ */
+{
+
+	if (n)
+		playqueue(n);
+
+}
+
+void yackplay(byte i)
+/*! 
+ @brief     Queues a keyed TX / Sidetone for the duration of a dit or a dah
+ 
+ @param i   DIT or DAH
+ 
+ */
+{
+
+	switch (i) {
+	case DAH:
+		playqueue(PQMARK | DAHLEN);
+		break;
+
+	case DIT:
+		playqueue(PQMARK | DITLEN);
+		break;
+	}
+
+}
+
+void yackchar(char c)
+/*! 
+ @brief     Send a character in morse code
+ 
+ This function translates a character passed as parameter into morse code using the 
+ translation table in Flash memory. It then queues the characters elements for the playback 
+ engine and adds all necessary gaps (as if the character was part of a longer word).
+ The function returns as soon as the last element is queued, so the caller can prepare 
+ the next character while this one is played. Use yackwait to wait for the end of playback.
+ 
+ If the character can not be translated, nothing is sent.
+ 
+ If a space is received, an interword gap is sent.
+
+ @param c   The character to send
+ 
+ */
+
+{
+	byte code = 0; // 0 is not a morse character, nothing is sent
+
+	// First we need to map the actual character to the encoded morse sequence in
+	// the array "morsecode". It is indexed by the character itself.
+	if (c >= 0x60) // Lower case (and the few characters around it)?
+		c -= 0x20; // Fold it onto the upper case range
+
+	if (c > ' ' && c < 0x60) // Within the table?
+		code = pgm_read_byte(&morsecode[c - ' ']); // A single flash read
+
+	if (c == ' ') // Do they want us to transmit a space (a gap of 7 dots)
+		yackdelay(IWGLEN - ICGLEN); // ICG was already played after previous char
+	else {
+		while (code & 0x7F) // Stop when EOC bit has reached MSB (or no code at all)
+		{
+			if (playwait(2)) // Room for element and gap? Stop playing if someone pushes key
+				return;
+
+			if (code & 0x80) 	// MSB set ?
+				yackplay(DAH);      // ..then play a dash
+			else
+				// MSB cleared ?
+				yackplay(DIT);		// .. then play a dot
+
+			yackdelay(IEGLEN);	// Inter Element gap
+
+			code = code << 1;	// Shift code on position left (to next element)
+		}
+
+		yackdelay(ICGLEN - IEGLEN); // IEG was already played after element
+
+		yackfarns(); // Insert another gap for farnsworth keying
+
+	}
+
+}
+
+void yackstring(const char *p)
+/*! 
+ @brief     Sends a 0-terminated string in CW which resides in Flash
+ 
+ Reads character by character from flash, translates into CW and keys the transmitter
+ and/or sidetone depending on feature bit settings.
+ 
+ @param p   Pointer to string location in FLASH 
+ 
+ */
+{
+
+	char c;
+
+	while ((c = pgm_read_byte(p++)) && !(yackctrlkey(TRUE)))
+		// While end of string in flash not reached and ctrl not pressed
+		yackchar(c);            // Play the read character
+								// abort now if someone presses command key
+
+	if (yackwait()) // Wait for the last character
+		yackctrlkey(TRUE); // Reset the latch like the loop above
+
+}
+
+static byte numsend(word n, byte width, byte cut)
+/*! 
+ @brief     Sends the digits of a number
+ 
+ The digits are found by subtracting the powers of ten in numpowers, so that no
+ division routine is needed.
+ 
+ This is a private function.
+ 
+ @param n       The number to send
+ @param width   Least number of digits, filled up with leading zeros
+ @param cut     TRUE to send cut numbers (see cutdigits)
+ @return        TRUE if aborted by the command key
+ 
+ */
+{
+
+	byte i;
+	byte d;
+	word p;
+
+	for (i = NUMDIGITS; i; i--) {
+		p = pgm_read_word(&numpowers[NUMDIGITS - i]);
+
+		for (d = 0; n >= p; d++) // Count how often the power fits
+			n -= p;
+
+		if (d || i == 1) // Sent from the first digit that is not 0
+			width = width > i ? width : i;
+
+		if (width < i)
+			continue;
+
+		if (yackctrlkey(FALSE))
+			return TRUE;
+
+		yackchar(cut ? pgm_read_byte(&cutdigits[d]) : d + '0');
+	}
+
+	return FALSE;
+
+}
+
+void yacknumber(word n)
+/*! 
+ @brief     Sends a number in CW
+ 
+ Transforms a number up to 65535 into its digits and sends them in CW
+ 
+ @param n   The number to send
+ 
+ */
+
+{
+
+	if (numsend(n, 1, FALSE))
+		yackctrlkey(TRUE); // The command key only ends the number
+
+	yackchar(' ');
+	yackwait();
+
+}
+
+void yackdigits(word n, byte width)
+/*! 
+ @brief     Sends a number as part of a text
+
+ Unlike yacknumber, no space follows and the caller waits for the playback. With the 
+ CUTNUMS option, the digits 0, 1 and 9 are sent as T, A and N, as is usual in contests.
+ 
+ @param n       The number to send
+ @param width   Least number of digits, filled up with leading zeros
+ 
+ */
+{
+
+	numsend(n, width, yackopts & CUTNUMS);
+
+}
+
+// ***************************************************************************
+// CW Keying related functions
+// ***************************************************************************
+
+static void keylatch(void)
+/*! 
+ @brief     Latches the status of the DIT and DAH paddles
+ 
+ If either DIT or DAH are keyed, this function sets the corresponding bit in 
+ volflags. This is used by the IAMBIC keyer to determine which element needs to 
+ be sounded next.
+ 
+ With PCICAPTURE, closures captured by the pin change interrupt since the last call
+ are latched as well, even if the paddle was already released again. Captures older
+ than STALECNT are dropped, they were made while the keyer was busy elsewhere.
+ 
+ This is a private function.
+
+ */
+{
+
+	byte swap;	 // Status of swap flag
+	byte closed; // Paddle contacts closed (KEYINP bits)
+#ifdef TIMESTAMPS
+	word stamp;	// Time of the closure
+#endif
+#ifdef PCICAPTURE
+	word now;	// Time of this call
+	byte captured;	// Closures captured by the ISR
+#endif
+#ifdef LATSTATS
+	byte latched;	// Paddle memory before this call
+
+	latched = volflags & SQUEEZED;
+#endif
+
+	swap = (yackflags & PDLSWAP);
+
+	closed = ~KEYINP;
+
+#ifdef TIMESTAMPS
+	cli();
+	stamp = timestamp();
+#ifdef PCICAPTURE
+	now = stamp;
+	captured = pcilatch;
+	pcilatch = 0;
+	if (captured)
+		stamp = pcistamp;
+#endif
+	sei();
+#endif
+
+#ifdef PCICAPTURE
+	if ((word)(now - stamp) < STALECNT) // Recent enough?
+		closed |= captured;
+	else
+		stamp = now;
+#endif
+
+	if (closed & (1 << DITPIN))
+		volflags |= (swap ? DAHLATCH : DITLATCH);
+
+	if (closed & (1 << DAHPIN))
+		volflags |= (swap ? DITLATCH : DAHLATCH);
+
+#ifdef LATSTATS
+	if (!latched && (volflags & SQUEEZED) && !latpending) // New closure?
+	{
+		latstart = stamp;
+		latpending = TRUE;
+	}
+#endif
+
+}
+
+#ifdef PCICAPTURE
+
+static byte pdlcapture(void)
+/*! 
+ @brief     Collects the paddle closures captured by the pin change interrupt
+ 
+ This is a private function.
+ 
+ @return    KEYINP bits of the paddles closed since the last call
+ 
+ */
+{
+
+	byte closed;
+
+	cli();
+	closed = pcilatch;
+	pcilatch = 0;
+	sei();
+
+	return closed;
+
+}
+
+#endif
+
+#ifdef LATSTATS
+
+void yackstats(void)
+/*! 
+ @brief     Sends the latency statistics in CW
+ 
+ Sends three numbers: the worst and the average time from a paddle closure seen in
+ keylatch to the key going down, both in Timer1 counts (BEATCLK Hz, 64 us at 1 MHz), 
+ followed by the number of overrun heartbeat ticks. The latency includes the wait for
+ an element or gap in progress when the closure is latched into the paddle memory.
+ All statistics are cleared once they have been sent completely.
+ 
+ */
+{
+
+	yacknumber(latmax);
+	yacknumber(yackdiv(latsum, latcount));
+	yacknumber(overruns);
+
+	if (!yackctrlkey(FALSE)) // Not interrupted?
+	{
+		latmax = latcount = overruns = 0;
+		latsum = 0;
+	}
+
+}
+
+#endif
+
+static void ctrldelay(void)
+/*! 
+ @brief     Debounce delay of the command key
+ 
+ Waits 50 ms. _delay_ms counts F_CPU cycles, so with CLOCKPROFILE the clock is 
+ dropped to F_CPU first. The heartbeat raises it again when there is keying to do.
+ 
+ This is a private function.
+ 
+ */
+{
+
+#ifdef CLOCKPROFILE
+	clockset(FALSE);
+#endif
+
+	_delay_ms(50);
+
+}
+
+byte yackctrlkey(byte mode)
+/*! 
+ @brief     Scans for the Control key
+ 
+ This function is regularly called at different points in the program. In a normal case
+ it terminates instantly. When the command key is found to be closed, the routine idles
+ until it is released again and returns a TRUE return value.
+ 
+ If, during the period where the contact was closed one of the paddles was closed too,
+ the wpm speed is changed and the keypress not interpreted as a Control request. 
+
+ @param mode    TRUE if caller has taken care of command key press, FALSE if not
+ @return        TRUE if a press of the command key is not yet handled. 
+ 
+ @callergraph
+ 
+ */
+{
+
+	byte volbfr;
+	byte closed; // Paddle contacts closed (KEYINP bits)
+
+	volbfr = volflags; // Remember current volatile settings
+
+	if (!(BTNINP & (1 << BTNPIN))) // If command button is pressed
+	{
+
+		volbfr |= CKLATCH; // Set control key latch
+
+		// Apparently the control key has been pressed. To avoid bouncing
+		// We will now wait a short while and then busy wait until the key is
+		// released.
+		// Should we find that someone is keying the paddle, let him change
+		// the speed and pretend ctrl was never pressed in the first place..
+
+		if (!(volflags & CKBUSY)) // Unless called from a speed change confirmation
+			playstop(); // Stop any playback right away
+
+		yackinhibit(ON); // Stop keying, switch on sidetone.
+		volflags |= CKBUSY; // Cleared again when restoring volflags
+
+		ctrldelay();
+
+		while (!(BTNINP & (1 << BTNPIN))) // Busy wait for release
+		{
+
+			closed = ~KEYINP;
+
+#ifdef PCICAPTURE
+			closed |= pdlcapture(); // Including taps during the debounce delay
+#endif
+
+			if (closed & (1 << DITPIN)) // Someone pressing DIT paddle
+			{
+				yackspeed(DOWN, WPMSPEED);
+				volbfr &= ~(CKLATCH); // Ignore that control key was pressed
+			}
+
+			if (closed & (1 << DAHPIN)) // Someone pressing DAH paddle
+			{
+				yackspeed(UP, WPMSPEED);
+				volbfr &= ~(CKLATCH);
+			}
+
+		}
+
+		ctrldelay(); // Trailing edge debounce
+
+#ifdef PCICAPTURE
+		pdlcapture(); // Closures so far were speed changes, not keying
+#endif
+
+		yacksave();	// In case we had a speed change
+
+	}
+
+	volflags = volbfr; // Restore previous state
+
+	if (mode == TRUE) // Does caller want us to reset latch?
+	{
+		volflags &= ~(CKLATCH);
+	}
+
+	//yacksave(); // In case we had a speed change (Does NOT work if command is here - moved immediately after button release debounce)
+
+	return ((volbfr & CKLATCH) != 0); // Tell caller if we had a ctrl button press
+
+}
+
+static char morsechar(byte buffer)
+/*! 
+ @brief     Reverse maps a combination of dots and dashes to a character
+ 
+ This routine is passed a sequence of dots and dashes in the format we use for morse
+ character encoding (see top of this file). It looks up the corresponding character in
+ the Flash table and returns it to the caller. 
+ 
+ Depending on DECODEMAP, the lookup is done in constant time in a reverse map, or by
+ scanning the encode table.
+ 
+ This is a private function.
+ 
+ @param buffer    A character in YACK CW notation
+ @return          The mapped character or /0 if no match was found  
+ 
+ */
+{
+#if DECODEMAP == 256
+
+	return pgm_read_byte(&morsemap[buffer]);
+
+#else
+
+	byte i;
+
+#if DECODEMAP == 128
+
+	if (!(buffer & 1)) // Up to 6 elements? Then the map knows it
+		return pgm_read_byte(&morsemap[buffer >> 1]);
+
+#endif
+
+	for (i = 0; i < sizeof(morsecode); i++) {
+
+		if (pgm_read_byte(&morsecode[i]) == buffer)
+			return (' ' + i); // The encode table is indexed by character
+
+	}
+
+	return '\0';
+
+#endif
+}
+
+static void msgremove(byte start, byte size)
+/*! 
+ @brief     Removes the bytes of an old message from the pool
+ 
+ All bytes stored behind it are moved down to close the gap, so that the free space 
+ is always at the end of the pool, and the directory is updated accordingly. 
+ Unchanged bytes are not rewritten.
+ 
+ This is a private function.
+ 
+ @param start   Offset of the old message
+ @param size    Its size in bytes
+ 
+ */
+{
+
+	byte j, s;
+
+	if (!size)
+		return;
+
+	for (j = start; j + size < MSGPOOL; j++) // Move the rest of the pool down
+		eeprom_update_byte(&msgpool[j], eeprom_read_byte(&msgpool[j + size]));
+
+	for (j = 0; j < MSGCOUNT; j++) // and point the directory to the new places
+	{
+		s = eeprom_read_byte(&msgdir[j][0]);
+		if (s > start)
+			eeprom_update_byte(&msgdir[j][0], s - size);
+	}
+
+}
+
+void yackmessage(byte function, byte msgnr)
+/*! 
+ @brief     Handles EEPROM stored CW messages (macros)
+ 
+ When called in RECORD mode, the function records a message up to RBSIZE characters and stores it in 
+ EEPROM. The routine stops recording when timing out after DEFTIMEOUT seconds. Recording
+ can be aborted using the control key. If more than RBSIZE characters are recorded, the error prosign
+ is sounded and recording starts from the beginning. To erase a message, do not key one.
+ 
+ Messages are packed into 6 bits per character and share the MSGPOOL bytes of EEPROM, so each 
+ uses only as much space as it needs. While recording, each completed byte is written right away
+ to the free space behind the stored messages. The directory is only pointed to the new message
+ at the end, then the old one is removed, so an aborted recording leaves the old message intact.
+ If the free space can not take a message of RBSIZE characters, the old message is removed 
+ before recording starts instead, as moving the pool takes several ms per byte and would stall
+ the keyer while the operator is sending. If the new message does not fit, the error prosign 
+ is sounded.
+ 
+ When called in PLAY mode, the message is played back, reading one byte at a time from EEPROM. 
+ As yackchar returns as soon as a character is queued, the next byte is read while the previous
+ character is still being sent. Playback can be aborted using the command key.
+ 
+ With MSGMACROS, tokens in the message are expanded while it is played: MSGSERIAL sends the 
+ next contest serial number, kept in user storage 2, MSGREPEAT followed by a digit n sends 
+ the text since the start or the previous MSGREPEAT n times in total (twice without a digit), 
+ and MSGSPEED followed by two digits sends the rest at that speed (without, at the speed set).
+ The speed set is restored at the end, unless the user has changed it in the meantime. 
+ 
+ @param     function    RECORD or PLAY
+ @param     msgnr       1 .. MSGCOUNT
+ 
+ */
+{
+	char c;					// Work character
+
+	word extimer = 0;		// Detects end of message (10 sec)
+
+	byte i = 0;				// Characters recorded
+	byte n;					// Generic counter
+	byte start, len;		// Directory entry of the message
+	byte base = 0;			// Start of the new message
+	byte pos;				// Next pool byte to write
+	word bits = 0;			// Bit stream, the lower nbits are pending
+	byte nbits = 0;
+
+	if (!msgnr || msgnr > MSGCOUNT)
+		return;
+
+	msgnr--; // Directory index
+
+	start = eeprom_read_byte(&msgdir[msgnr][0]);
+	len = eeprom_read_byte(&msgdir[msgnr][1]);
+
+	if (function == RECORD) {
+
+		// The new message goes behind all stored ones
+		for (n = 0; n < MSGCOUNT; n++)
+			base += MSGBYTES(eeprom_read_byte(&msgdir[n][1]));
+
+		if (base + MSGBYTES(RBSIZE) > MSGPOOL && len) // No room for the longest message?
+		{
+			yackwait(); // The heartbeat stops while the pool is moved
+			eeprom_update_byte(&msgdir[msgnr][1], 0);
+			msgremove(start, MSGBYTES(len)); // Drop the old message now
+			base -= MSGBYTES(len);
+			len = 0;
+		}
+
+		pos = base;
+
+		extimer = YACKSECS(DEFTIMEOUT);	// 5 Second until message end
+		while (extimer--)	// Continue until we waited 10 seconds
+		{
+			if (yackctrlkey(TRUE))
+				return;
+
+			if ((c = yackiambic(ON)) >= ' ' && c < 0x60) // Check for a character from the key
+			{
+				if (base + MSGBYTES(i + 1) > MSGPOOL) // No room left?
+					i = RBSIZE; // Handled like the end of the buffer
+				else {
+					bits = (bits << 6) | MSGCODE(c); // Append the 6 bit code
+					nbits += 6;
+
+					if (nbits >= 8) // Another byte complete?
+					{
+						nbits -= 8;
+						eeprom_update_byte(&msgpool[pos++], bits >> nbits);
+					}
+
+					i++;
+				}
+
+				extimer = YACKSECS(DEFTIMEOUT); // Reset End of message timer
+			}
+
+			if (i >= RBSIZE) // End of buffer reached?
+			{
+				yackerror();
+				i = nbits = 0;
+				pos = base;
+			}
+
+			yackbeat(); // 10 ms heartbeat
+		}
+
+		// Extimer has expired. Message has ended
+
+		if (i) // Was anything received at all?
+		{
+			i--; // Drop the trailing space
+
+			if (nbits) // Write the last partial byte
+				eeprom_update_byte(&msgpool[pos], bits << (8 - nbits));
+
+			// Point the directory to the new message and drop the old one
+			eeprom_update_byte(&msgdir[msgnr][0], base);
+			eeprom_update_byte(&msgdir[msgnr][1], i);
+			msgremove(start, MSGBYTES(len));
+		} else
+			yackerror();
+	}
+
+	if (function == PLAY) {
+
+		struct msgreader rd = { start, len, 0, 0 };
+
+#ifdef MSGMACROS
+		struct msgreader mark = rd;	// Start of the text a repeat token sends again
+		byte repleft = 0xFF;		// Position of the current repeat token (rd.left behind it)
+		byte repeats = 0;			// Repeats of that text still to send
+		byte speed = wpm;			// Restored at the end
+		byte cur = wpm;				// Speed the tokens left in effect
+		word serial = 0;			// Serial number of this playback, 0 until sent
+#endif
+
+		// Replay the message
+		while (rd.left) { // Read until end of message
+			if (yackctrlkey(FALSE) || (volflags & PDLBREAK))
+				break; //Break immediately if command key pressed or the paddles broke in
+
+			c = msgget(&rd);
+
+#ifdef MSGMACROS
+
+			if (c == MSGSERIAL) {
+				if (!serial) { // The first one in this playback takes the next number
+					serial = yackuser(READ, 2, 0) + 1;
+					if (serial > MSGMAXSER)
+						serial = 1;
+					yackuser(WRITE, 2, serial);
+				}
+				yackdigits(serial, 3); // At least three digits, like 001
+				continue;
+			}
+
+			if (c == MSGREPEAT) {
+				n = msgnumber(&rd, 1);
+				if (rd.left != repleft) { // Arrived at this token for the first time?
+					repleft = rd.left;
+					repeats = n > 1 ? n - 1 : (n ? 0 : 1); // Sent twice without a count
+				}
+				if (repeats) {
+					repeats--;
+					rd = mark; // Back to the start of the text
+				} else
+					mark = rd; // The next repeat starts behind this token
+				continue;
+			}
+
+			if (c == MSGSPEED) {
+				n = msgnumber(&rd, 2);
+				if (wpm != cur)
+					speed = wpm; // Changed by the user meanwhile, that is the one set now
+				if (!n)
+					n = speed; // Without a speed back to the one set
+				if (n >= MINWPM && n <= MAXWPM) {
+					yackwait(); // The queued elements keep their speed
+					yackwpmset(n);
+					cur = wpm;
+				}
+				continue;
+			}
+
+#endif
+
+			yackchar(c); // play it back 
+		}
+
+		yackwait();
+
+#ifdef MSGMACROS
+		// Back to the speed set, unless the user has changed it since the last token
+		if (wpm == cur && wpm != speed)
+			yackwpmset(speed);
+#endif
+
+	}
+
+}
+
+static char msgget(struct msgreader *rd)
+/*! 
+ @brief     Reads the next character of a stored message
+ 
+ This is a private function.
+ 
+ @param rd  Read position in the message, must have characters left
+ @return    The character
+ 
+ */
+{
+
+	if (rd->nbits < 6) // Next byte needed for this character?
+	{
+		rd->bits = (rd->bits << 8) | eeprom_read_byte(&msgpool[rd->pos++]);
+		rd->nbits += 8;
+	}
+
+	rd->nbits -= 6;
+	rd->left--;
+
+	return ((rd->bits >> rd->nbits) & 0x3F) + ' ';
 
 }
 
-void yackchar(char c)
+#ifdef MSGMACROS
+
+static byte msgnumber(struct msgreader *rd, byte digits)
 /*! 
- @brief     Send a character in morse code
+ @brief     Reads the number following a token in a stored message
  
- This function translates a character passed as parameter into morse code using the 
- translation table in Flash memory. It then keys transmitter / sidetone with the characters
- elements and adds all necessary gaps (as if the character was part of a longer word).
- 
- If the character can not be translated, nothing is sent.
+ This is a private function.
  
- If a space is received, an interword gap is sent.
-
- @param c   The character to send
+ @param rd      Read position in the message, moved behind the digits
+ @param digits  Most digits to read
+ @return        The number, 0 if no digit follows
  
  */
-
 {
-	byte code = 0x80; // 0x80 is an empty morse character (just eoc bit set)
-	byte i; // a counter
 
-	// First we need to map the actual character to the encoded morse sequence in
-	// the array "morse"
-	if (c >= '0' && c <= '9') // Is it a numerical digit?
-		code = pgm_read_byte(&morse[c - '0']); // Find it in the beginning of array
+	struct msgreader peek;
+	byte n = 0;
+	char c;
 
-	if (c >= 'a' && c <= 'z') // Is it a character?
-		code = pgm_read_byte(&morse[c - 'a' + 10]); // Find it from position 10
+	while (digits-- && rd->left) {
+		peek = *rd;
+		c = msgget(&peek);
 
-	if (c >= 'A' && c <= 'Z') // Is it a character in upper case?
-		code = pgm_read_byte(&morse[c - 'A' + 10]); // Same as above
+		if (c < '0' || c > '9')
+			break;
 
-	// Last we need to handle special characters. There is a small char
-	// array "spechar" which contains the characters for the morse elements
-	// at the end of the "morse" array (see there!)
-	for (i = 0; i < sizeof(spechar); i++) // Read through the array
-		if (c == pgm_read_byte(&spechar[i])) // Does it contain our character
-			code = pgm_read_byte(&morse[i + 36]); // Map it to morse code
+		*rd = peek;
+		n = n * 10 + c - '0';
+	}
 
-	if (c == ' ') // Do they want us to transmit a space (a gap of 7 dots)
-		yackdelay(IWGLEN - ICGLEN); // ICG was already played after previous char
-	else {
-		while (code != 0x80) // Stop when EOC bit has reached MSB
-		{
-			if (yackctrlkey(FALSE)) // Stop playing if someone pushes key
-				return;
+	return n;
 
-			if (code & 0x80) 	// MSB set ?
-				yackplay(DAH);      // ..then play a dash
-			else
-				// MSB cleared ?
-				yackplay(DIT);		// .. then play a dot
+}
 
-			yackdelay(IEGLEN);	// Inter Element gap
+#endif
 
-			code = code << 1;	// Shift code on position left (to next element)
-		}
+#if !defined(FIXEDMODE) || FIXEDMODE == IAMBICA || FIXEDMODE == IAMBICB
 
-		yackdelay(ICGLEN - IEGLEN); // IEG was already played after element
+static void idleiambic(void)
+/*! 
+ @brief     Paddle latching of IAMBIC A and B in the IDLE state
+ 
+ When the paddle keys are squeezed, we need to ensure that dots and dashes are 
+ alternating. To do that, we delete any latched paddle of the same kind that we 
+ just sent. However, we only do this ONCE.
+ 
+ If that leaves nothing latched, the paddles are latched again, so that a paddle which is
+ still held repeats its element right away and not one beat later.
+ 
+ This is a private function.
+ 
+ */
+{
 
-		yackfarns(); // Insert another gap for farnsworth keying
+	volflags &= ~lastsymbol;
+	lastsymbol = 0;
 
-	}
+	if (!(volflags & SQUEEZED)) // Not squeezed, so nothing to alternate with?
+		keylatch();
 
 }
 
-void yackstring(const char *p)
+#endif
+
+#if !defined(FIXEDMODE) || FIXEDMODE == ULTIMATIC
+
+static void idleultimatic(void)
 /*! 
- @brief     Sends a 0-terminated string in CW which resides in Flash
+ @brief     Paddle latching of ULTIMATIC in the IDLE state
  
- Reads character by character from flash, translates into CW and keys the transmitter
- and/or sidetone depending on feature bit settings.
+ The last paddle to be active will be repeated indefinitely. In case the keyer is 
+ squeezed right out of idle mode, we just send a DAH.
  
- @param p   Pointer to string location in FLASH 
+ This is a private function.
  
  */
 {
 
-	char c;
-
-	while ((c = pgm_read_byte(p++)) && !(yackctrlkey(TRUE)))
-		// While end of string in flash not reached and ctrl not pressed
-		yackchar(c);            // Play the read character
-								// abort now if someone presses command key
+	if ((volflags & SQUEEZED) == SQUEEZED) // Squeezed?
+	{
+		if (ultimem)
+			volflags &= ~ultimem; // Opposite symbol from last one
+		else
+			volflags &= ~DITLATCH; // Reset the DIT latch
+	} else {
+		ultimem = volflags & SQUEEZED; // Remember the last single key
+	}
 
 }
 
-void yacknumber(word n)
+#endif
+
+#if !defined(FIXEDMODE) || FIXEDMODE == DAHPRIO
+
+static void idledahprio(void)
 /*! 
- @brief     Sends a number in CW
+ @brief     Paddle latching of DAH priority mode in the IDLE state
  
- Transforms a number up to 65535 into its digits and sends them in CW
+ If both paddles are pressed, DAH is given priority.
  
- @param n   The number to send
+ This is a private function.
  
  */
-
 {
 
-	char buffer[5];
-	byte i = 0;
+	if ((volflags & SQUEEZED) == SQUEEZED)
+		volflags &= ~DITLATCH; // Reset the DIT latch
 
-	while (n) // Until nothing left or control key pressed
-	{
-		buffer[i++] = n % 10 + '0'; // Store rest of division by 10
-		n /= 10;                // Divide by 10
-	}
+}
 
-	while (i) {
-		if (yackctrlkey(TRUE)) {
-			break;
-		}
-		yackchar(buffer[--i]);
-	}
+#endif
 
-	yackchar(' ');
+#if !defined(FIXEDMODE) || FIXEDMODE != IAMBICB
+
+static void keyedignore(void)
+/*! 
+ @brief     Paddle latching of all modes but IAMBIC B in the KEYED state
+ 
+ The paddles are ignored while an element is sounded. With PCICAPTURE, closures 
+ captured in the meantime are dropped.
+ 
+ This is a private function.
+ 
+ */
+{
+
+#ifdef PCICAPTURE
+	pdlcapture();
+#endif
 
 }
 
-// ***************************************************************************
-// CW Keying related functions
-// ***************************************************************************
+#endif
 
-static void keylatch(void)
+#ifndef FIXEDMODE
+
+static void modeset(void)
 /*! 
- @brief     Latches the status of the DIT and DAH paddles
+ @brief     Selects the paddle latching of the keyer mode in yackflags
  
- If either DIT or DAH are keyed, this function sets the corresponding bit in 
- volflags. This is used by the IAMBIC keyer to determine which element needs to 
- be sounded next.
+ Called whenever the mode bits change, so that yackiambic does not need to look at 
+ them on every heartbeat. IAMBIC B latches the paddles while keyed already.
  
  This is a private function.
-
+ 
  */
 {
 
-	byte swap;	 // Status of swap flag
+	switch (yackflags & MODE) {
+	case IAMBICA:
+		idlemode = idleiambic;
+		keyedmode = keyedignore;
+		break;
 
-	swap = (yackflags & PDLSWAP);
+	case IAMBICB:
+		idlemode = idleiambic;
+		keyedmode = keylatch;
+		break;
 
-	if (!( KEYINP & (1 << DITPIN)))
-		volflags |= (swap ? DAHLATCH : DITLATCH);
+	case ULTIMATIC:
+		idlemode = idleultimatic;
+		keyedmode = keyedignore;
+		break;
 
-	if (!( KEYINP & (1 << DAHPIN)))
-		volflags |= (swap ? DITLATCH : DAHLATCH);
+	case DAHPRIO:
+		idlemode = idledahprio;
+		keyedmode = keyedignore;
+		break;
+	}
 
 }
 
-byte yackctrlkey(byte mode)
+#endif
+
+#ifdef STRAIGHTKEY
+
+static char straightkey(byte ctrl)
 /*! 
- @brief     Scans for the Control key
+ @brief     Keys and decodes a straight key or bug
  
- This function is regularly called at different points in the program. In a normal case
- it terminates instantly. When the command key is found to be closed, the routine idles
- until it is released again and returns a TRUE return value.
+ Called by yackiambic instead of the IAMBIC FSM when the STRAIGHT flag is set. The 
+ key follows the paddle contacts, either of them closes it. A bug therefore works
+ with its dit and dah contacts on the two paddle inputs, or both on one of them.
  
- If, during the period where the contact was closed one of the paddles was closed too,
- the wpm speed is changed and the keypress not interpreted as a Control request. 
-
- @param mode    TRUE if caller has taken care of command key press, FALSE if not
- @return        TRUE if a press of the command key is not yet handled. 
+ Mark and space durations are measured in Timer1 counts, from the time stamps of the
+ pin change interrupt with PCICAPTURE, else from the heartbeat that sees the change.
+ A mark longer than two estimated dots is a dah, a space longer than two dots ends the
+ character and one longer than five dots the word. Every mark that is plausibly a dit
+ or a dah moves the dot estimate by 1/SKWEIGHT towards its length, so the decoder
+ follows the speed of the operator. It starts out at the keyer speed.
  
- @callergraph
+ This is a private function.
+ 
+ @param ctrl    ON if the keyer should recognize when a word ends. OFF if not.
+ @return        The character if one was recognized, /0 if not
  
  */
 {
 
-	byte volbfr;
-
-	volbfr = volflags; // Remember current volatile settings
+	static byte down = FALSE;	// Key closed at the last call
+	static word edge;			// Time stamp of the last key edge
+	static word dot = 0;		// Estimated dot length in Timer1 counts
+	static byte buffer = 0;		// Elements of the current character
+	static byte bcntr = 0;		// Number of elements in buffer
+	static byte iwgflag = 0;	// Waiting for the end of the word?
+	byte closed;
+	word now;
+	word d;
+	char c;
 
-	if (!(BTNINP & (1 << BTNPIN))) // If command button is pressed
-	{
+	if (!dot)
+		dot = yackdiv(DOTCNT(1), wpm);
 
-		volbfr |= CKLATCH; // Set control key latch
+	closed = (~KEYINP & ((1 << DITPIN) | (1 << DAHPIN))) ? TRUE : FALSE;
 
-		// Apparently the control key has been pressed. To avoid bouncing
-		// We will now wait a short while and then busy wait until the key is
-		// released.
-		// Should we find that someone is keying the paddle, let him change
-		// the speed and pretend ctrl was never pressed in the first place..
+	cli();
+	now = timestamp();
+#ifdef PCICAPTURE
+	if (closed != down && (word)(now - pciedge) < 2 * BEATCNT) // The ISR saw the edge?
+		now = pciedge;
+#endif
+	sei();
 
-		yackinhibit(ON); // Stop keying, switch on sidetone.
+	d = now - edge;
 
-		_delay_ms(50);
+	if (closed != down) // Edge?
+	{
+		edge = now;
+		down = closed;
 
-		while (!(BTNINP & (1 << BTNPIN))) // Busy wait for release
+		if (closed) // Mark begins
 		{
+			iwgflag = 0;
+			playstop(); // Keying interrupts any playback
+			key(DOWN);
+			return '\0';
+		}
 
-			if (!( KEYINP & (1 << DITPIN))) // Someone pressing DIT paddle
-			{
-				yackspeed(DOWN, WPMSPEED);
-				volbfr &= ~(CKLATCH); // Ignore that control key was pressed
-			}
+		key(UP); // Mark ends, d is its length
 
-			if (!( KEYINP & (1 << DAHPIN))) // Someone pressing DAH paddle
+		if (bcntr < 8) // Room for the element? 8 means too many
+		{
+			buffer <<= 1;
+			if (d > 2 * dot) // Dah?
 			{
-				yackspeed(UP, WPMSPEED);
-				volbfr &= ~(CKLATCH);
+				buffer |= 1;
+				d = yackdiv(d, 3);
 			}
-
+			bcntr++;
 		}
 
-		_delay_ms(50); // Trailing edge debounce
+		if (d > dot / 2 && d < 2 * dot) // Plausible, then learn from it
+			dot += ((int16_t) (d - dot)) / SKWEIGHT;
 
-		yacksave();	// In case we had a speed change
+		if (dot < DOTCNT(MAXWPM))
+			dot = DOTCNT(MAXWPM);
+		if (dot > DOTCNT(MINWPM))
+			dot = DOTCNT(MINWPM);
 
+		return '\0';
 	}
 
-	volflags = volbfr; // Restore previous state
+	if (down) // Mark goes on
+	{
+#ifdef POWERSAVE
+		yackpower(FALSE);
+#endif
+		if (d > 0x8000) // Don't let a very long mark wrap around
+			edge = now - 0x8000;
+		return '\0';
+	}
 
-	if (mode == TRUE) // Does caller want us to reset latch?
+	if (bcntr && d > 2 * dot) // End of the character?
 	{
-		volflags &= ~(CKLATCH);
+		c = '\0';
+		if (bcntr < 8)
+			c = morsechar(((buffer << 1) | 1) << (7 - bcntr));
+		buffer = bcntr = 0;
+		iwgflag = (ctrl == ON);
+		return c;
 	}
 
-	//yacksave(); // In case we had a speed change (Does NOT work if command is here - moved immediately after button release debounce)
+	if (iwgflag && d > 5 * dot) // End of the word?
+	{
+		iwgflag = 0;
+		return ' ';
+	}
 
-	return ((volbfr & CKLATCH) != 0); // Tell caller if we had a ctrl button press
+#ifdef POWERSAVE
+	if (!bcntr && !iwgflag)
+		yackpower(TRUE);
+#endif
+
+	return '\0';
 
 }
 
-static char morsechar(byte buffer)
+#endif
+
+static word gaplimit(byte wordend)
 /*! 
- @brief     Reverse maps a combination of dots and dashes to a character
+ @brief     Idle time after which yackiambic decides that a character or word has ended
  
- This routine is passed a sequence of dots and dashes in the format we use for morse
- character encoding (see top of this file). It looks up the corresponding character in
- the Flash table and returns it to the caller. 
+ The idle time is counted from the end of the inter-element gap. Without GAPLEARN, a 
+ character has ended after ICGLEN and a word after IWGLEN dots of gap. With GAPLEARN, 
+ the character ends at half the average gap between characters, since the keyer adds 
+ no idle time between the elements of a character. The word ends halfway between the 
+ averages of the gaps between characters and words. The defaults of both averages 
+ give the fixed thresholds.
+ 
+ The character threshold only moves down from ICGLEN. Characters that were run together
+ leave no gap to learn from, so a later threshold would only learn ever longer gaps.
  
  This is a private function.
  
- @param buffer    A character in YACK CW notation
- @return          The mapped character or /0 if no match was found  
+ @param wordend FALSE for the end of a character, TRUE for the end of a word
+ @return        Heartbeats of idle time
  
  */
 {
-	byte i;
 
-	for (i = 0; i < sizeof(morse); i++) {
+#ifdef GAPLEARN
 
-		if (pgm_read_byte(&morse[i]) == buffer) {
-			if (i < 10)
-				return ('0' + i);		// First 10 chars are digits
-			if (i < 36)
-				return ('A' + i - 10);	// Then follow letters
-			return (pgm_read_byte(&spechar[i - 36])); // Then special chars
-		}
+	word c;
+	word w;
 
+	c = gapchr / 2;
+	if (c < GAPFIX / 2)
+		c = GAPFIX / 2;
+	if (c > GAPFIX) // Never later than the fixed threshold, see above
+		c = GAPFIX;
+
+	if (wordend)
+	{
+		w = (gapchr + gapwrd) / 2;
+		if (w < c + GAPFIX)
+			w = c + GAPFIX;
+		if (w > 8 * GAPFIX)
+			w = 8 * GAPFIX;
+		c = w;
 	}
 
-	return '\0';
+	return (c * wpmcnt + GAPFIX / 2) / GAPFIX;
+
+#else
+
+	return (wordend ? IWGLEN - IEGLEN - 1 : ICGLEN - IEGLEN - 1) * wpmcnt;
+
+#endif
+
 }
 
-void yackmessage(byte function, byte msgnr)
+#ifdef GAPLEARN
+
+static void gaplearn(word idle)
 /*! 
- @brief     Handles EEPROM stored CW messages (macros)
+ @brief     Adds a gap between characters or words to the running averages
  
- When called in RECORD mode, the function records a message up to 100 characters and stores it in 
- EEPROM. The routine stops recording when timing out after DEFTIMEOUT seconds. Recording
- can be aborted using the control key. If more than 100 characters are recorded, the error prosign
- is sounded and recording starts from the beginning. After recording and timing out the message is played
- back once before it is stored. To erase a message, do not key one.
+ Called when an element starts after the previous character has ended. Gaps longer
+ than three times the word threshold are pauses and are left out.
  
- When called in PLAY mode, the message is just played back. Playback can be aborted using the command
- key.
+ This is a private function.
  
- @param     function    RECORD or PLAY
- @param     msgnr       1 or 2
- @return    TRUE if all OK, FALSE if lock prevented message recording
+ @param idle    Heartbeats of idle time before the element
  
  */
 {
-	unsigned char rambuffer[RBSIZE];	// Storage for the message
-	unsigned char c;					// Work character
-
-	word extimer = 0;		// Detects end of message (10 sec)
-
-	byte i = 0;				// Pointer into RAM buffer
-	byte n;					// Generic counter
-
-	if (function == RECORD) {
-
-		extimer = YACKSECS(DEFTIMEOUT);	// 5 Second until message end
-		while (extimer--)	// Continue until we waited 10 seconds
-		{
-			if (yackctrlkey(TRUE))
-				return;
-
-			if ((c = yackiambic(ON))) // Check for a character from the key
-			{
-				rambuffer[i++] = c; // Add that character to our buffer
-				extimer = YACKSECS(DEFTIMEOUT); // Reset End of message timer
-			}
-
-			if (i >= RBSIZE) // End of buffer reached?
-			{
-				yackerror();
-				i = 0;
-			}
-
-			yackbeat(); // 10 ms heartbeat
-		}
-
-		// Extimer has expired. Message has ended
 
-		if (i) // Was anything received at all?
-		{
-			rambuffer[--i] = 0; // Add a \0 end marker over last space
-
-			// Replay the message
-			//for (n=0;n<i;n++){
-			//	if (yackctrlkey(TRUE)) {return;} //Break to command mode without saving if command key pressed
-			//	yackchar(rambuffer[n]);
-			//}
-
-			// Store it in EEPROM
-			if (msgnr == 1)
-				eeprom_write_block(rambuffer, eebuffer1, RBSIZE);
-			if (msgnr == 2)
-				eeprom_write_block(rambuffer, eebuffer2, RBSIZE);
-		} else
-			yackerror();
-	}
+	word w;
+	word g;
 
-	if (function == PLAY) {
-		// Retrieve the message from EEPROM
-		if (msgnr == 1)
-			eeprom_read_block(rambuffer, eebuffer1, RBSIZE);
-		if (msgnr == 2)
-			eeprom_read_block(rambuffer, eebuffer2, RBSIZE);
+	w = gaplimit(TRUE);
+	if (idle >= 3 * w) // Just a pause?
+		return;
 
-		// Replay the message
-		for (n = 0; (c = rambuffer[n]); n++) { // Read until end of message
-			if (yackctrlkey(FALSE)) {
-				return;
-			} //Break immediately if command key pressed
-			yackchar(c); // play it back 
-		}
+	g = yackdiv(idle * GAPFIX, wpmcnt);
 
-	}
+	if (idle < w) // Between characters
+		gapchr += ((int16_t) (g - gapchr)) / GAPWEIGHT;
+	else // Between words
+		gapwrd += ((int16_t) (g - gapwrd)) / GAPWEIGHT;
 
 }
 
+#endif
+
 char yackiambic(byte ctrl)
 /*! 
  @brief     Finite state machine for the IAMBIC keyer
@@ -1095,11 +3824,14 @@ char yackiambic(byte ctrl)
 
 	static enum FSMSTATE fsms = IDLE;	// FSM state indicator
 	static word timer;			// A countdown timer
-	static byte lastsymbol;		// The last symbol sent
 	static byte buffer = 0;		// A place to store a sent char
 	static byte bcntr = 0;		// Number of elements sent
+#ifdef GAPLEARN
+	static word gapstart;		// beatclock when the last gap between characters began
+	static byte gapseen = 0;	// Flag: gapstart is valid
+	word idle;
+#endif
 	static byte iwgflag = 0;	// Flag: Are we in interword gap?
-	static byte ultimem = 0;    // Buffer for last keying status
 	char retchar;		// The character to return to caller
 
 	// This routine is called every YACKBEAT ms. It starts with idle mode where
@@ -1117,6 +3849,13 @@ char yackiambic(byte ctrl)
 	// altogether), we assume that the word has ended. A space char
 	// is transmitted in this case.
 
+	volflags &= ~PDLBREAK; // The paddles are ours again, playback may be queued
+
+#ifdef STRAIGHTKEY
+	if (yackflags & STRAIGHT) // Straight key or bug?
+		return straightkey(ctrl);
+#endif
+
 	if (timer)
 		timer--; // Count down
 
@@ -1135,41 +3874,7 @@ char yackiambic(byte ctrl)
 
 #endif            
 
-		// Handle latching logic for various keyer modes
-		switch (yackflags & MODE) {
-		case IAMBICA:
-		case IAMBICB:
-			// When the paddle keys are squeezed, we need to ensure that
-			// dots and dashes are alternating. To do that, whe delete
-			// any latched paddle of the same kind that we just sent.
-			// However, we only do this ONCE
-
-			volflags &= ~lastsymbol;
-			lastsymbol = 0;
-			break;
-
-		case ULTIMATIC:
-			// Ultimatic logic: The last paddle to be active will be repeated indefinitely
-			// In case the keyer is squeezed right out of idle mode, we just send a DAH
-			if ((volflags & SQUEEZED) == SQUEEZED) // Squeezed?
-			{
-				if (ultimem)
-					volflags &= ~ultimem; // Opposite symbol from last one
-				else
-					volflags &= ~DITLATCH; // Reset the DIT latch
-			} else {
-				ultimem = volflags & SQUEEZED; // Remember the last single key
-			}
-
-			break;
-
-		case DAHPRIO:
-			// If both paddles pressed, DAH is given priority
-			if ((volflags & SQUEEZED) == SQUEEZED) {
-				volflags &= ~DITLATCH; // Reset the DIT latch
-			}
-			break;
-		}
+		idlemode(); // Latching logic of the keyer mode
 
 		// The following handles the inter-character gap. When there are
 		// three (default) dot lengths of space after an element, the
@@ -1182,8 +3887,8 @@ char yackiambic(byte ctrl)
 			buffer = buffer << (7 - bcntr); // Shift to left justify
 			retchar = morsechar(buffer); // Attempt decoding
 			buffer = bcntr = 0;			// Clear buffer
-			timer = (IWGLEN - ICGLEN) * wpmcnt;	// If 4 further dots of gap,
-			// this might be a Word gap.
+			timer = gaplimit(TRUE) - gaplimit(FALSE);	// If the gap goes on up to
+			// the word threshold, this might be a Word gap.
 			iwgflag = 1; // Signal we are waiting for IWG
 			return (retchar);			// and return decoded char
 		}
@@ -1196,10 +3901,24 @@ char yackiambic(byte ctrl)
 			return (' ');  // And return a space
 		}
 
+#ifdef LATSTATS
+		if (!(volflags & SQUEEZED)) // Latch cleared by the mode logic above?
+			latpending = FALSE; // Then there is nothing to be keyed
+#endif
+
 		// Now evaluate the latch and determine what to send next
 		if (volflags & (DITLATCH | DAHLATCH)) // Anything in the latch?
 				{
 			iwgflag = 0; // No interword gap if dit or dah
+#ifdef GAPLEARN
+			if (!bcntr && gapseen) // First element after a character gap?
+			{
+				cli();
+				idle = beatclock - gapstart; // Real time, the caller may have been busy
+				sei();
+				gaplearn(idle);
+			}
+#endif
 			bcntr++;	// Count that we will send something now
 			buffer = buffer << 1; // Make space for the new character
 
@@ -1214,6 +3933,7 @@ char yackiambic(byte ctrl)
 				buffer |= 1; // set LSB to remember dash
 			}
 
+			playstop(); // Paddle input interrupts any playback
 			key(DOWN); // Switch on the side tone and TX
 			volflags &= ~(DITLATCH | DAHLATCH); // Reset both latches
 
@@ -1230,13 +3950,14 @@ char yackiambic(byte ctrl)
 
 #endif
 
-		if ((yackflags & MODE) == IAMBICB) // If we are in IAMBIC B mode
-			keylatch();                      // then latch here already
+		keyedmode(); // IAMBIC B latches here already, the other modes ignore the paddles
 
 		if (timer == 0) // Done with sounding our element?
 				{
 			key(UP); // Then cancel the side tone
-			timer = IEGLEN * wpmcnt; // One dot time for the gap
+			// One dot time for the gap. The IDLE state keys the next element one beat
+			// after the gap has timed out, so the gap times out one beat early.
+			timer = IEGLEN * wpmcnt - 1;
 			fsms = IEG; // Change FSM state
 		}
 
@@ -1252,7 +3973,13 @@ char yackiambic(byte ctrl)
 			// The following timer determines what the IDLE state
 			// accepts as character. Anything longer than 2 dots as gap will be
 			// accepted for a character end.
-			timer = (ICGLEN - IEGLEN - 1) * wpmcnt;
+			timer = gaplimit(FALSE);
+#ifdef GAPLEARN
+			cli();
+			gapstart = beatclock;
+			sei();
+			gapseen = 1;
+#endif
 		}
 		break;
 
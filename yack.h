@@ -76,13 +76,33 @@
 #define		BTNINP			PINA
 #define		BTNPIN			2
 
+// Definition of where the serial input (SERIALIN) is connected
+#define		RXPORT			PORTA
+#define		RXINP			PINA
+#define		RXPIN			6		// Any port A pin, the pin change interrupt detects start bits
+
+// Flow control output of the serial input, connect to CTS of the host
+#define		CTSDDR			DDRA
+#define		CTSPORT			PORTA
+#define		CTSPIN			4
+
+// Definition of where the serial output (SERIALOUT) is connected
+#define		TXDDR			DDRA
+#define		TXPORT			PORTA
+#define		TXPIN			5
+
+// Definition of where the PTT output (PTT) is connected
+#define		PTTDDR			DDRA
+#define		PTTPORT			PORTA
+#define		PTTPIN			3
+
 #endif
 
 // The following defines the meaning of status bits in the yackflags and volflags 
 // global variables
 
 // Definition of the yackflags variable. These settings get stored in EEPROM when changed.
-#define		NOTUSED1		0b00000001  // Available
+#define		STRAIGHT		0b00000001  // Set if a straight key or bug is connected to the paddle input
 #define     CONFLOCK		0b00000010  // Configuration locked down
 #define		MODE			0b00001100  // 2 bits to define keyer mode (see next section)
 #define		SIDETONE		0b00010000  // Set if the chip must produce a sidetone
@@ -97,6 +117,15 @@
 
 #define		FLAGDEFAULT		IAMBICB | TXKEY | SIDETONE
 
+// Definition of the yackopts variable. These settings get stored in EEPROM when changed.
+#define		CUTNUMS			0b00000001  // Set if numbers in messages and readouts are sent as cut numbers
+
+#define		OPTDEFAULT		0
+
+// Uncomment to build for one keyer mode only. yackiambic then contains just the paddle latching
+// of that mode, and yackmode and the mode commands are left out. The mode bits are ignored.
+//#define		FIXEDMODE		IAMBICB
+
 // Definition of volflags variable. These flags do not get stored in EEPROM.
 #define		DITLATCH		0b00000001  // Set if DIT contact was closed
 #define     DAHLATCH		0b00000010  // Set if DAH contact was closed
@@ -104,6 +133,8 @@
 #define		DIRTYFLAG		0b00000100  // Set if cfg data was changed and needs storing
 #define     CKLATCH         0b00001000  // Set if the command key was pressed at some point
 #define		VSCOPY          0b00110000  // Copies of Sidetone and TX flags from yackflags
+#define		CKBUSY			0b01000000  // Set while yackctrlkey waits for the command key release
+#define		PDLBREAK		0b10000000  // Set once the paddles broke off playback, until yackiambic runs
 
 // The following defines timing constants. In the default version the keyer is set to operate in
 // 10ms heartbeat intervals. If a higher resolution is required, this can be changed to a faster
@@ -114,8 +145,13 @@
 #define		YACKSECS(n)		(n*(1000/YACKBEAT)) // Beats in n seconds (off by 2x for 5ms heartbeat)
 #define		YACKMS(n)		(n/YACKBEAT) // Beats in n milliseconds
 
-// Power save mode
+// Power save mode. Between heartbeats the CPU always sleeps in idle mode. After SBTIME seconds
+// without keying, the keyer goes into standby: the heartbeat stops and the CPU is powered down,
+// with the watchdog waking it every few seconds to keep the seconds clock (yacktime) going until
+// an alarm set with yackalarm is due. SBTIME must be longer than the timeouts counted in 
+// heartbeats (MACTIMEOUT). After PSTIME seconds without an alarm, the watchdog is switched off.
 #define     POWERSAVE       // Comment this line if no power save mode required
+#define     SBTIME          20 // 20 seconds until standby
 #define     PSTIME          30 // 30 seconds until automatic powerdown
 
 #ifdef TINY85
@@ -134,8 +170,156 @@
 #define     WPMSPEED        0
 #define     MAXFARN         255
 
+// Weight and compensation parameters (WEIGHTING)
+#define		WEIGHT			2
+#define		COMPENSATION	3
+#define		MINWEIGHT		25		// Mark/space ratio of a dot and its gap in %
+#define		MAXWEIGHT		75
+#define		DEFWEIGHT		50		// Marks and gaps as long as each other
+#define		MAXCOMP			15		// Compensation in ms
+#define		DEFCOMP			0
+
 #define		WPMCALC(n)		((1200/YACKBEAT)/n) // Calculates number of beats in a dot 
 
+// Fine timing mode. WPMCALC rounds down to whole heartbeats, which makes speeds above
+// 30 WPM noticeably inaccurate. With FINETIMING, the heartbeat period is trimmed for each
+// speed instead so that a dot is a whole number of beats. Element timing is then accurate
+// to better than 1%, at the cost of the heartbeat (and the timeouts counted in beats)
+// deviating by up to 9% from YACKBEAT ms at the highest speeds.
+#define		FINETIMING		// Comment this line to keep a fixed heartbeat
+
+#define		BEATCLK			(F_CPU/64)	// Timer1 clock in Hz (see yackinit)
+#define		BEATCNT			(BEATCLK*YACKBEAT/1000) // Timer1 counts in a heartbeat
+#define		DOTCNT(n)		(BEATCLK*6/5/(n)) // Timer1 counts in a dot (1.2 s / WPM)
+
+#if DOTCNT(1) > 0xFFFF
+#error Timer1 clock too fast for FINETIMING
+#endif
+
+// Keying weight and compensation. Every mark on the TX key line is lengthened by 2% of a dot
+// per percent of weight above DEFWEIGHT and by the compensation in ms, and the gap after it is 
+// shortened by as much, so the speed stays the same. Weights below DEFWEIGHT shorten the marks.
+// The edges are timed to one Timer1 count with compare match B, not to whole heartbeats. On the
+// ATtiny84 with SERIALIN or SERIALOUT, compare match B serves the serial bits and the edges are
+// rounded to heartbeats instead. The sidetone keeps the element lengths as they are.
+#define		WEIGHTING		// Comment this line to key the TX with unweighted elements
+#define		COMPCNT(ms)		yackdiv((uint32_t)(ms) * BEATCLK, 1000)	// Timer1 counts in ms
+#define		WTRECIP			((65536L + (100-DEFWEIGHT)/2) / (100-DEFWEIGHT)) // 65536/(100-DEFWEIGHT)
+
+// Latency statistics. Records the time from a paddle closure seen in keylatch to the key
+// going down, and counts heartbeat ticks that were overrun. yackstats sends them in CW.
+#define		LATSTATS		// Comment this line to leave out the latency statistics
+
+// Paddle capture. The pin change interrupt latches paddle closures the moment they occur,
+// so that short taps between two heartbeats or during the delays in yackctrlkey are not lost.
+#define		PCICAPTURE		// Comment this line to only poll the paddles once per heartbeat
+#define		PCIDEBOUNCE		3	// ms a paddle must have been open before a closure counts
+
+// Gap learning. yackiambic keeps running averages of the idle time the operator leaves
+// between characters and between words, and places the decoding thresholds between them
+// instead of at the fixed ICGLEN and IWGLEN. This only affects decoding, not sending.
+// A new gap moves its average by 1/GAPWEIGHT of its difference from it.
+#define		GAPLEARN		// Comment this line to keep the fixed gap thresholds
+#define		GAPWEIGHT		4
+
+// Straight key and bug decoder. With the STRAIGHT flag set, yackiambic follows the paddle
+// contacts directly and decodes the marks and spaces with a running estimate of the dot
+// length, so command mode, the trainer and message recording work with a straight key.
+// A new element moves the estimate by 1/SKWEIGHT of its difference from it.
+#define		STRAIGHTKEY		// Comment this line to leave out the straight key decoder
+#define		SKWEIGHT		8
+
+// Message macros. Tokens keyed into a stored message are expanded when it is played back:
+// MSGSERIAL sends a contest serial number that counts up with every playback, MSGREPEAT and a
+// digit n sends the text before it n times, MSGSPEED and two digits changes the speed.
+#define		MSGMACROS		// Comment this line to play stored messages as recorded
+#define		MSGSERIAL		'_'		// ..--.-
+#define		MSGREPEAT		'>'		// AA
+#define		MSGSPEED		'<'		// VE
+#define		MSGMAXSER		9999	// Serial numbers wrap around to 1 after this
+
+// Setting profiles. PROFILES copies of the settings record are kept in EEPROM besides the
+// journal. yackprofile stores the current settings into one of them, or makes one the current
+// settings with a single read of CFGSIZE bytes, so a contest and a rag chew setup are one
+// command apart. Profiles are numbered from 1, so that they can be keyed as a digit.
+#define		PROFILES		4		// Comment this line to leave out the setting profiles
+
+#if defined(PROFILES) && (PROFILES < 1 || PROFILES > 9)
+#error PROFILES must be 1 to 9
+#endif
+
+#if defined(LATSTATS) || defined(PCICAPTURE) || defined(STRAIGHTKEY) || defined(GAPLEARN)
+#define		TIMESTAMPS		// Time stamps in Timer1 counts are needed
+#endif
+
+// Random seed. yackinit seeds the random generator (yackrandom) from the jitter between the
+// watchdog oscillator and the system clock, so the trainer plays different content after each
+// power up. This adds RNDSEEDS watchdog periods of 16 ms to the start up time.
+#define		RANDOMSEED		// Comment this line to start the random generator from a fixed seed
+#define		RNDSEEDS		8
+
+// Trainer statistics. The callsign trainer of the keyer application records the misses and
+// the response time of each character, sends the callsigns with the characters missed most
+// often more likely and steps the speed up or down with the rolling accuracy.
+#define		TRAINSTATS		// Comment this line to leave out the trainer statistics
+
+// Dictionary trainer. The keyer application trains common words, Q-codes and callsign prefixes
+// from word lists, which the Makefile packs into dict.h with tools/mkdict. Leave it out on chips
+// with less flash like the ATtiny45, the lists take about 1 KB.
+#define		TRAINDICT		// Comment this line to leave out the dictionaries
+
+// Serial input. A software UART receiver (8N1 at SERBAUD) fills a type-ahead buffer, which the
+// keyer application sends in CW at the current speed. The pin change interrupt catches the 
+// start bit and Timer1 compare match B samples the bits, so the heartbeat is not disturbed. 
+// The CTS output goes high when the buffer is nearly full and low again once it is half empty.
+// Only available on the ATtiny84, the ATtiny85 has no free pin.
+//#define		SERIALIN		// Uncomment this line for the serial type-ahead input
+#define		RXSIZE			32		// Receive buffer (must be a power of 2)
+#define		RXHIGH			(RXSIZE-8)	// Buffered characters at which CTS goes high
+#define		RXLOW			(RXSIZE/2)	// ... and low again
+
+// Serial output. The keyer application passes each character decoded from the paddles, and 
+// a space for each word gap, to a software UART transmitter (8N1 at SERBAUD), e.g. for a 
+// logging program. Characters wait in a buffer and Timer1 compare match B shifts out the bits,
+// shared with the serial input, so the keyer never waits for the line. Only on the ATtiny84.
+//#define		SERIALOUT		// Uncomment this line for the serial output of decoded characters
+#define		TXSIZE			16		// Transmit buffer (must be a power of 2)
+
+#define		SERBAUD			1200
+#define		SERBITCNT		((BEATCLK+SERBAUD/2)/SERBAUD) // Timer1 counts in a bit
+
+#if (defined(SERIALIN) || defined(SERIALOUT)) && !defined(TINY84)
+#error SERIALIN and SERIALOUT need free pins, which only the ATtiny84 has
+#endif
+
+// PTT sequencer for break-in with an amplifier or antenna relays. The PTT output goes high
+// as soon as a mark is keyed, and the TX key line follows the keying PTTLEAD ms later, so 
+// the relays have settled before RF is applied. PTT drops PTTHANG ms after the last mark on
+// air, which holds it over the gaps in semi break-in. The sidetone is not delayed. Both times
+// are rounded to heartbeats, and the key line is an exact, delayed copy of the keying.
+// Only available on the ATtiny84, the ATtiny85 has no free pin.
+//#define		PTT				// Uncomment this line for the PTT output
+#define		PTTLEAD			15		// ms from PTT to the key line, 1 to 16 heartbeats
+#define		PTTHANG			250		// ms PTT is held after the key line, up to 255 heartbeats
+
+#define		PTTBEATS		((PTTLEAD + YACKBEAT - 1) / YACKBEAT)
+#define		PTTHANGBEATS	YACKMS(PTTHANG)
+
+#if defined(PTT) && !defined(TINY84)
+#error PTT needs a free pin, which only the ATtiny84 has
+#endif
+
+#if defined(PTT) && (PTTBEATS < 1 || PTTBEATS > 16 || PTTHANGBEATS > 255)
+#error PTTLEAD or PTTHANG out of range
+#endif
+
+// Reverse lookup used to decode keyed characters. 0 scans the encode table (smallest),
+// 128 or 256 use a constant time map of that many bytes in flash (see morsechar in yack.c).
+// "make decodesize" reports the flash use of each variant.
+#ifndef DECODEMAP
+#define		DECODEMAP		128
+#endif
+
 #define		DITLEN			1	// Length of a dot
 #define		DAHLEN			3	// Length of a dash
 #define		IEGLEN			1	// Length of inter-element gap
@@ -164,11 +348,83 @@
 #define		MINCTC			CTCVAL(MINFREQ) 
 #define		DEFCTC			CTCVAL(DEFFREQ)
 
+// Shaped sidetone. Instead of switching a CTC square wave on and off, Timer0 runs in fast
+// PWM mode and its overflow interrupt plays a sine from a flash table, with a raised cosine
+// rise and fall of RAMPTIME ms at the edges of each element. The PWM carrier is F_CPU/256
+// (3.9 kHz at 1 MHz), so the output needs a low pass or the bandpass filter.
+#define		SHAPEDTONE		// Comment this line for the plain square wave sidetone
+#define		RAMPTIME		4		// Rise and fall time in ms
+
+#define		TONERATE		(F_CPU/256)	// Samples per second (one per PWM period)
+#define		TONESAMPLES		16		// Samples in one period of the sine table
+#define		RAMPSTEPS		8		// Envelope levels from silence to full volume
+#define		RAMPCNT			((TONERATE*RAMPTIME/1000+RAMPSTEPS/2)/RAMPSTEPS) // Samples per level
+
+// Phase step of the sine per sample for a CTC value, so that the pitch setting applies to
+// both sidetones. This is 65536 * frequency / TONERATE with both expanded, divided with yackdiv.
+#define		TONESTEP(ctc)	yackdiv(0x1000000UL/(2*PRESCALE), (ctc)+1)
+
+// Clock profile. The keyer runs at F_CPU while idle and CLKFACTOR times faster while keying
+// or playing back, and for CLKIDLE seconds after that. This shortens the interrupt latency,
+// and lifts the carrier of the shaped sidetone out of the audio range. The timer prescalers
+// are switched along with the clock, so the heartbeat, the time stamps and the CTC pitch
+// values are the same in both profiles. F_CPU must be the internal 8 MHz oscillator divided
+// by 8 (CKDIV8 fuse), as set in the Makefile.
+#define		CLOCKPROFILE	// Comment this line to run at F_CPU all the time
+#define		CLKIDLE			2		// Seconds without keying until the clock drops to F_CPU
+
+#define		CLKSLOWDIV		3		// CLKPR setting for F_CPU (8 MHz / 8)
+
+#ifdef TINY85
+#define		CLKFACTOR		8		// 8 MHz, Timer1 prescaled by 512 instead of 64
+#define		CLKFASTDIV		0		// CLKPR setting for the fast clock
+#elif defined TINY84
+#define		CLKFACTOR		4		// 4 MHz, Timer1 prescaled by 256 (there is no 512)
+#define		CLKFASTDIV		1
+#endif
+
+#ifdef CLOCKPROFILE
+#if F_CPU != 1000000
+#error CLOCKPROFILE needs F_CPU = 1000000 (8 MHz oscillator, CKDIV8)
+#endif
+#if defined(TINY84) && !defined(SHAPEDTONE)
+#error CLOCKPROFILE on the ATtiny84 needs SHAPEDTONE, Timer0 has no prescaler for CTC at 4 MHz
+#endif
+#define		RAMPMAX			(255 / CLKFACTOR) // RAMPCNT is scaled up at the fast clock
+#else
+#define		RAMPMAX			255
+#endif
+
+#if defined(SHAPEDTONE) && (RAMPCNT < 1 || RAMPCNT > RAMPMAX)
+#error RAMPTIME out of range for this clock
+#endif
+
 // The following are various definitions in use throughout the program
-#define		RBSIZE			100     // Size of each of the four EEPROM buffers
+#define		RBSIZE			100     // Maximum length of a message in characters
+#define		MSGCOUNT		4		// Number of messages stored in EEPROM
+#define		MSGPOOL			200		// EEPROM bytes shared by all messages (max. 255)
+
+// Messages are stored in 6 bit codes (character - 0x20), 4 characters in 3 bytes
+#define		MSGBYTES(n)		(((n) * 3 + 3) / 4)	// EEPROM bytes for n characters
+#define		PQSIZE			8		// Element queue of the playback engine (must be a power of 2)
 
 #define		MAGPAT			0xA5    // If this number is found in EEPROM, content assumed valid
 
+// Settings record. The settings are journaled through a ring of CFGSLOTS records in EEPROM,
+// each save going to the next slot. At power up, the valid record with the newest sequence
+// number is loaded. A record is valid if its last byte matches the check value.
+#define		CFGSLOTS		4		// Records in the ring
+#define		CFGSEQ			0		// Sequence number
+#define		CFGFLAGS		1		// yackflags
+#define		CFGCTC			2		// Pitch (2 bytes, low byte first)
+#define		CFGWPM			4		// Speed
+#define		CFGFARNS		5		// Farnsworth pause
+#define		CFGOPTS			6		// yackopts
+#define		CFGWEIGHT		7		// Weight
+#define		CFGCOMP			8		// Compensation
+#define		CFGCHECK		9		// MAGPAT ^ sum of all bytes before
+#define		CFGSIZE			10		// Bytes in a record
+
 #define		DIT				1
 #define		DAH             2
 
@@ -201,25 +457,56 @@ void yackstring(const char *p);
 char yackiambic(byte ctrl);
 void yackpitch(uint8_t dir);
 void yacktune(void);
+#ifndef FIXEDMODE
 void yackmode(uint8_t mode);
+#endif
 void yackinhibit(uint8_t mode);
 void yackerror(void);
 void yacktoggle(byte flag);
 byte yackflag(byte flag);
+void yackoption(byte opt);
+byte yackoptflag(byte opt);
 void yackbeat(void);
 void yackmessage(byte function, byte msgnr);
 void yacksave(void);
 byte yackctrlkey(byte mode);
 void yackreset(void);
 word yackuser(byte func, byte nr, word content);
+#ifdef PROFILES
+byte yackprofile(byte func, byte nr);
+#endif
 void yacknumber(word n);
+void yackdigits(word n, byte width);
 word yackwpm(void);
+#ifdef WEIGHTING
+byte yackweight(byte mode);
+#endif
+word yacktime(void);
+byte yackrandom(byte n);
 void yackplay(byte i);
 void yackdelay(byte n);
 void yackfarns(void);
 void yackspeed(byte dir, byte mode);
+void yackwpmset(word n);
+void yackwpmhold(byte mode);
+word yackdiv(uint32_t n, word d);
+byte yackbusy(void);
+byte yackwait(void);
+
+#ifdef LATSTATS
+void yackstats(void);
+#endif
 
 #ifdef POWERSAVE
 void yackpower(byte n);
+void yackalarm(word t);
+#endif
+
+#ifdef SERIALIN
+char yackrx(void);
+#endif
+
+#ifdef SERIALOUT
+void yacktx(char c);
 #endif
 